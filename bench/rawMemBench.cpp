@@ -0,0 +1,320 @@
+/* --------------------------------------------------------
+   Benchmark of the rawMem routines: cost of allocating, linking and
+   releasing the pointer tables, and access throughput through the
+   pointer tables compared with flat base[i*nx+j] indexing, for ranks
+   1-6, float and double, rarray and rmap over an external buffer.
+
+   No dependencies, compile with e.g.:
+
+     g++ -O3 -march=native -std=c++11 -I.. rawMemBench.cpp -o rawMemBench
+     (add -fopenmp to time the parallel table filling)
+
+   Usage: ./rawMemBench [log2 of the elements per array, default 22]
+
+   All times are per element (ns/el) except alloc/del/rmap (ms). "ptr" is
+   access through the pointer tables, "flat" through a flat offset.
+   seq walks in memory order, strd walks with the outermost index
+   fastest and rand visits random elements.
+ */
+#include "rawMem.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+namespace{
+
+  typedef std::chrono::steady_clock rclock;
+
+  volatile double rsink = 0;
+
+  inline double since(rclock::time_point const& t0)
+  {
+    return std::chrono::duration<double>(rclock::now() - t0).count();
+  }
+
+  // --- rmap needs two dimensions at least, rank 1 is never mapped --- //
+
+  template<typename T, int N> struct remap{
+    template<typename... A> static typename rmem::rptr<T,N>::type map(T *v, A const&... a){ return rmem::rmap(v, a...); }
+    template<typename... A> static void del(typename rmem::rptr<T,N>::type &p, A const&... a){ rmem::del_rmap(p, a...); }
+  };
+  template<typename T> struct remap<T,1>{
+    static T* map(T *v, long const& x1l, long const&){ return v - x1l; }
+    static void del(T *&p, long const&){ p = NULL; }
+  };
+
+  // --- passes the bounds in b[2N] to the variadic rmem routines --- //
+
+  template<typename T, int N, int K = 0> struct call{
+    template<typename... A> static typename rmem::rptr<T,N>::type alloc(long const* b, A const&... a)
+    {
+      return call<T,N,K+1>::alloc(b, a..., b[2*K], b[2*K+1]);
+    }
+    template<typename... A> static typename rmem::rptr<T,N>::type map(T *v, long const* b, A const&... a)
+    {
+      return call<T,N,K+1>::map(v, b, a..., b[2*K], b[2*K+1]);
+    }
+    template<typename... A> static void del(typename rmem::rptr<T,N>::type &p, long const* b, A const&... a)
+    {
+      call<T,N,K+1>::del(p, b, a..., b[2*K]);
+    }
+    template<typename... A> static void del_map(typename rmem::rptr<T,N>::type &p, long const* b, A const&... a)
+    {
+      call<T,N,K+1>::del_map(p, b, a..., b[2*K]);
+    }
+  };
+
+  template<typename T, int N> struct call<T,N,N>{
+    template<typename... A> static typename rmem::rptr<T,N>::type alloc(long const*, A const&... a)
+    {
+      return rmem::rarray<T>(rmem::uninit, a...);
+    }
+    template<typename... A> static typename rmem::rptr<T,N>::type map(T *v, long const*, A const&... a)
+    {
+      return remap<T,N>::map(v, a...);
+    }
+    template<typename... A> static void del(typename rmem::rptr<T,N>::type &p, long const*, A const&... a)
+    {
+      rmem::del_rarray(p, a...);
+    }
+    template<typename... A> static void del_map(typename rmem::rptr<T,N>::type &p, long const*, A const&... a)
+    {
+      remap<T,N>::del(p, a...);
+    }
+  };
+
+  // --- sequential sweep through the pointer tables, as nested loops --- //
+
+  template<typename T, int N> struct seq{
+    static double run(typename rmem::rptr<T,N>::type p, long const* lo, long const* hi)
+    {
+      double s = 0;
+      for(long ii=lo[0]; ii<=hi[0]; ++ii) s += seq<T,N-1>::run(p[ii], lo+1, hi+1);
+      return s;
+    }
+  };
+  template<typename T> struct seq<T,1>{
+    static double run(T *p, long const* lo, long const* hi)
+    {
+      double s = 0;
+      for(long ii=lo[0]; ii<=hi[0]; ++ii) s += p[ii];
+      return s;
+    }
+  };
+
+  // --- the same sweep with base[((i*n1+j)*n2+k)...] indexing --- //
+
+  template<typename T, int N> struct seqf{
+    static double run(T const* v, long const& off, long const* n)
+    {
+      double s = 0;
+      for(long ii=0; ii<n[0]; ++ii) s += seqf<T,N-1>::run(v, (off+ii)*n[1], n+1);
+      return s;
+    }
+  };
+  template<typename T> struct seqf<T,1>{
+    static double run(T const* v, long const& off, long const* n)
+    {
+      double s = 0;
+      for(long ii=0; ii<n[0]; ++ii) s += v[off+ii];
+      return s;
+    }
+  };
+
+  // --- one access through the full chain of pointer tables --- //
+
+  template<typename T, int N> struct at{
+    static T& get(typename rmem::rptr<T,N>::type p, long const* i){ return at<T,N-1>::get(p[i[0]], i+1); }
+  };
+  template<typename T> struct at<T,1>{
+    static T& get(T *p, long const* i){ return p[i[0]]; }
+  };
+
+  // --- index tuples (and their flat offsets) visited by the strided and random tests --- //
+
+  void tuples(int const& N, long const* lo, long const* n, long const& m, bool const& rnd, std::vector<long> &idx, std::vector<long> &off)
+  {
+    idx.resize(m*N), off.resize(m);
+    long tot = 1;
+    for(int kk=0; kk<N; ++kk) tot *= n[kk];
+
+    unsigned long long st = 88172645463325252ULL;
+    for(long ii=0; ii<m; ++ii){
+      long e = ii % tot;
+      if(rnd){
+	st ^= st << 13, st ^= st >> 7, st ^= st << 17;
+	e = (long)(st % (unsigned long long)tot);
+      }
+
+      // --- strided: decompose with the outermost index varying fastest --- //
+
+      long r = e, o = 0;
+      if(rnd){
+	for(int kk=N-1; kk>=0; --kk) idx[ii*N+kk] = r % n[kk], r /= n[kk];
+      }else{
+	for(int kk=0; kk<N; ++kk) idx[ii*N+kk] = r % n[kk], r /= n[kk];
+      }
+      for(int kk=0; kk<N; ++kk) o = o*n[kk] + idx[ii*N+kk], idx[ii*N+kk] += lo[kk];
+      off[ii] = o;
+    }
+  }
+
+  struct result{
+    double alloc, del, rmap, seq, seqf, strd, strdf, rnd, rndf;
+    size_t tbytes, dbytes;
+  };
+
+  template<typename T, int N> result run(long const* n, int const& reps)
+  {
+    result r = {};
+    long b[2*N], lo[N], hi[N], tot = 1;
+    for(int kk=0; kk<N; ++kk){
+      lo[kk] = -kk, hi[kk] = lo[kk] + n[kk] - 1;
+      b[2*kk] = lo[kk], b[2*kk+1] = hi[kk], tot *= n[kk];
+    }
+
+    long rows = 1;
+    for(int kk=0; kk<N-1; ++kk) rows *= n[kk], r.tbytes += rows*sizeof(void*);
+    r.dbytes = tot*sizeof(T);
+
+    // --- allocation and release, best of reps --- //
+
+    r.alloc = r.del = r.rmap = 1.e30;
+    for(int rr=0; rr<reps; ++rr){
+      rclock::time_point t0 = rclock::now();
+      typename rmem::rptr<T,N>::type p = call<T,N>::alloc(b);
+      r.alloc = std::min(r.alloc, since(t0));
+
+      t0 = rclock::now();
+      call<T,N>::del(p, b);
+      r.del = std::min(r.del, since(t0));
+    }
+
+    typename rmem::rptr<T,N>::type p = call<T,N>::alloc(b);
+    T *v0 = &at<T,N>::get(p, lo);
+    for(long ii=0; ii<tot; ++ii) v0[ii] = T(ii % 7);
+
+    if(N > 1){
+      for(int rr=0; rr<reps; ++rr){
+	rclock::time_point t0 = rclock::now();
+	typename rmem::rptr<T,N>::type m = call<T,N>::map(v0, b);
+	r.rmap = std::min(r.rmap, since(t0));
+	rsink += at<T,N>::get(m, lo);
+	call<T,N>::del_map(m, b);
+      }
+    }else r.rmap = 0;
+
+    // --- access throughput --- //
+
+    r.seq = r.seqf = r.strd = r.strdf = r.rnd = r.rndf = 1.e30;
+    const long m = std::min(tot, 1L << 20);
+    std::vector<long> si, so, ri, ro;
+    tuples(N, lo, n, m, false, si, so);
+    tuples(N, lo, n, m, true, ri, ro);
+
+    for(int rr=0; rr<reps; ++rr){
+      rclock::time_point t0 = rclock::now();
+      rsink += seq<T,N>::run(p, lo, hi);
+      r.seq = std::min(r.seq, since(t0) / tot);
+
+      t0 = rclock::now();
+      rsink += seqf<T,N>::run(v0, 0, n);
+      r.seqf = std::min(r.seqf, since(t0) / tot);
+
+      double s = 0;
+      t0 = rclock::now();
+      for(long ii=0; ii<m; ++ii) s += at<T,N>::get(p, &si[ii*N]);
+      r.strd = std::min(r.strd, since(t0) / m);
+
+      t0 = rclock::now();
+      for(long ii=0; ii<m; ++ii) s += v0[so[ii]];
+      r.strdf = std::min(r.strdf, since(t0) / m);
+
+      t0 = rclock::now();
+      for(long ii=0; ii<m; ++ii) s += at<T,N>::get(p, &ri[ii*N]);
+      r.rnd = std::min(r.rnd, since(t0) / m);
+
+      t0 = rclock::now();
+      for(long ii=0; ii<m; ++ii) s += v0[ro[ii]];
+      r.rndf = std::min(r.rndf, since(t0) / m);
+      rsink += s;
+    }
+
+    call<T,N>::del(p, b);
+    return r;
+  }
+
+  template<typename T, int N> void report(const char *type, std::vector<long> const& shape, int const& reps)
+  {
+    const result r = run<T,N>(&shape[0], reps);
+
+    char dims[64] = "", tmp[24];
+    for(int kk=0; kk<N; ++kk){
+      snprintf(tmp, sizeof(tmp), (kk) ? "x%ld" : "%ld", shape[kk]);
+      strncat(dims, tmp, sizeof(dims) - strlen(dims) - 1);
+    }
+
+    printf("%d %-6s %-20s %9.3f %6.2f %9.3f %7.3f %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n",
+	   N, type, dims, r.tbytes / 1048576., 100.*r.tbytes / r.dbytes,
+	   r.alloc*1.e3, r.del*1.e3, r.rmap*1.e3,
+	   r.seq*1.e9, r.seqf*1.e9, r.strd*1.e9, r.strdf*1.e9, r.rnd*1.e9, r.rndf*1.e9);
+  }
+
+  // --- a few shapes per rank with 2^lg elements: balanced ones and
+  //     ones with a tiny innermost extent, the worst case for the tables --- //
+
+  std::vector<std::vector<long> > shapes(int const& N, int const& lg)
+  {
+    std::vector<std::vector<long> > res;
+
+    std::vector<long> s(N, 1);
+    for(int ii=0; ii<lg; ++ii) s[N-1 - ii%N] *= 2;
+    res.push_back(s);
+
+    if(N > 1){
+      for(int inner=2; inner<=4; inner+=2){
+	std::vector<long> t(N, 1);
+	t[N-1] = inner;
+	for(int ii=0, nb=lg - inner/2; ii<nb; ++ii) t[N-2 - ii%(N-1)] *= 2;
+	if(std::find(res.begin(), res.end(), t) == res.end()) res.push_back(t);
+      }
+    }
+    return res;
+  }
+
+  template<typename T, int N> void rank(const char *type, int const& lg, int const& reps)
+  {
+    std::vector<std::vector<long> > s = shapes(N, lg);
+    for(size_t ii=0; ii<s.size(); ++ii) report<T,N>(type, s[ii], reps);
+  }
+
+  template<typename T> void all(const char *type, int const& lg, int const& reps)
+  {
+    rank<T,1>(type, lg, reps);
+    rank<T,2>(type, lg, reps);
+    rank<T,3>(type, lg, reps);
+    rank<T,4>(type, lg, reps);
+    rank<T,5>(type, lg, reps);
+    rank<T,6>(type, lg, reps);
+  }
+
+}
+
+int main(int argc, char *argv[])
+{
+  const int lg = (argc > 1) ? atoi(argv[1]) : 22;
+  const int reps = 3;
+
+  printf("# 2^%d elements per array, best of %d runs\n", lg, reps);
+  printf("# N type   shape                  table_MB  tab_%%  alloc_ms  del_ms  rmap_ms"
+	 "  seq_ptr seq_flat strd_ptr strd_flt rand_ptr rand_flt\n");
+
+  all<float>("float", lg, reps);
+  all<double>("double", lg, reps);
+
+  return 0;
+}
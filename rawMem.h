@@ -7,543 +7,3302 @@
    every single variable type.
    
    Coded by J. de la Cruz Rodriguez (ISP-SU 2019)
+
+   rarray places all the pointer tables and the data in one single
+   allocation: a small header, the pointer tables (outermost first) and
+   the data block, which starts on a RMEM_ALIGN byte boundary (or the
+   alignment given in ropt). del_rarray only needs the header to release
+   everything with one call.
  */
 #ifndef RMEM_HPP
 #define RMEM_HPP
 
-#include <cstdlib>
+#include <cstdlib>
+#include <cstddef>
+#include <stdint.h>
+#include <new>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <vector>
+#include <typeinfo>
+#include <initializer_list>
+#include <tuple>
+#include <algorithm>
+#include <limits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RMEM_POSIX
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#ifdef RMEM_STATS
+#include <chrono>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifndef RMEM_ALIGN
+#define RMEM_ALIGN 64
+#endif
+
+#ifndef RMEM_HUGE_PAGE
+#define RMEM_HUGE_PAGE 2097152
+#endif
+
+#ifndef RMEM_POOL_MAX
+#define RMEM_POOL_MAX 64
+#endif
+
+#ifndef RMEM_POOL_BUCKETS
+#define RMEM_POOL_BUCKETS 64
+#endif
+
+#ifndef RMEM_PAR_MIN
+#define RMEM_PAR_MIN 65536
+#endif
+
+#ifndef RMEM_IO_CHUNK
+#define RMEM_IO_CHUNK 8388608
+#endif
+
+namespace rmem{
+
+  // --- placement of the data block on NUMA machines. numa_first_touch
+  //     initializes the data in parallel, each thread taking the same
+  //     slabs of the outermost dimension that a static "omp for" would give
+  //     it. numa_interleave spreads the pages round-robin over all the
+  //     allowed nodes (Linux only) --- //
+
+  enum rnuma{numa_none = 0, numa_first_touch = 1, numa_interleave = 2};
+
+  // --- huge page backing of the block. huge_thp maps it aligned to
+  //     RMEM_HUGE_PAGE and asks for transparent huge pages with madvise.
+  //     huge_tlb uses MAP_HUGETLB and falls back to huge_thp if the kernel has
+  //     no huge pages reserved. Use huge_bytes to see what was granted --- //
+
+  enum rhuge{huge_none = 0, huge_thp = 1, huge_tlb = 2};
+  
+  // --- how a file is mapped: read-only, copy-on-write or shared-writable --- //
+
+  enum rfmode{map_read = 0, map_private = 1, map_shared = 2};
+  
+  // --- allocation options for rarray. align is the alignment of the data
+  //     block in bytes (a power of two). With pad, the fastest-varying extent
+  //     is rounded up so that every row starts on an align boundary. If file
+  //     is set, the data is not allocated but mapped from that file starting
+  //     at byte offset (see mapped below). With pool, del_rarray keeps the
+  //     block, pointer tables included, in a per-thread cache and the next
+  //     rarray of the same type, shape and options reuses it. direct
+  //     makes save/load use O_DIRECT where the file system allows it.
+  //     shm means that file names a POSIX shared memory segment --- //
+  
+  struct ropt{
+    size_t align;
+    bool pad;
+    int numa;
+    int huge;
+    const char *file;
+    size_t offset;
+    int fmode;
+    bool pool;
+    bool direct;
+    bool shm;
+    
+    explicit ropt(size_t const& align_ = RMEM_ALIGN, bool const& pad_ = false, int const& numa_ = numa_none, int const& huge_ = huge_none):
+      align(align_), pad(pad_), numa(numa_), huge(huge_), file(NULL), offset(0), fmode(map_read), pool(false), direct(false), shm(false){}
+  };
+
+  /* --- Options to build an rarray over a raw binary file, which is mmap'ed
+         from byte offset onwards instead of allocated. Only the pages
+         that are accessed are read from disk. With map_shared, writes go
+         to the file (which is created/extended if needed). The data keeps
+         whatever the file contains, the init policy is ignored --- */
+  
+  inline ropt mapped(const char *file, size_t const& offset = 0, int const& mode = map_read)
+  {
+    ropt o;
+    o.file = file, o.offset = offset, o.fmode = mode;
+    return o;
+  }
+
+  /* --- The same over the POSIX shared memory segment name (e.g. "/cube"),
+         so that several processes share one copy of the data. Each one
+         builds its own pointer tables; del_rarray only detaches. The
+         process that fills it uses map_shared, which creates the segment
+         (zeroed) or extends it if needed, the others usually map_read.
+         The segment lives until unlink_shared(name) is called --- */
+  
+  inline ropt shared(const char *name, size_t const& offset = 0, int const& mode = map_read)
+  {
+    ropt o = mapped(name, offset, mode);
+    o.shm = true;
+    return o;
+  }
+
+  // --- catches mapped(file, mode) and shared(name, mode), which would
+  //     take the mode as the offset --- //
+  
+  ropt mapped(const char *file, rfmode const& mode) = delete;
+  ropt shared(const char *name, rfmode const& mode) = delete;
+  
+  // --- initialization policy of the data block: rmem::uninit leaves it
+  //     uninitialized, rmem::zeroed value-initializes it (the default) and
+  //     rmem::filled(v) sets every element to v --- //
+
+  enum rinit_mode{rinit_none = 0, rinit_zero = 1, rinit_value = 2};
+
+  struct uninit_t{};
+  struct zeroed_t{};
+  template<typename V> struct filled_t{ V v; };
+
+  static const uninit_t uninit = uninit_t();
+  static const zeroed_t zeroed = zeroed_t();
+  template<typename V> filled_t<V> filled(V const& v){ filled_t<V> f; f.v = v; return f; }
+
+  template<typename T> struct rinit{
+    int mode;
+    T value;
+
+    rinit(): mode(rinit_zero), value(){}
+    rinit(uninit_t const&): mode(rinit_none), value(){}
+    rinit(zeroed_t const&): mode(rinit_zero), value(){}
+    template<typename V> rinit(filled_t<V> const& f): mode(rinit_value), value(f.v){}
+  };
+  
+  // ****************************************************************** //
+
+  /* --- Allocation statistics, compiled in only if RMEM_STATS is defined
+         before including this file. Otherwise stats() returns zeros and
+         the rarray/del_rarray paths are untouched. Bytes are counted per
+         allocation, so blocks kept in a pool are still included; data
+         mapped from files is counted apart as it is backed by the page
+         cache. The counters are atomic, the totals of a snapshot taken
+         while other threads allocate are each exact but not mutually
+         consistent --- */
+
+  static const int stats_ranks = 8;
+
+  struct rstats{
+    long arrays;                 // arrays returned by rarray/rmap and not released
+    long blocks;                 // allocations alive, pooled ones included
+    size_t data_bytes;           // data blocks of those allocations
+    size_t table_bytes;          // their pointer tables
+    size_t file_bytes;           // data mapped from files or shared memory
+    size_t peak_bytes;           // highest data_bytes + table_bytes so far
+    long count[stats_ranks];     // rarray/rmap calls per rank, higher ranks in the last one
+    double seconds[stats_ranks]; // time spent in those calls
+  };
+
+  enum rstats_what{stats_alloc = 0, stats_free = 1};
+  
+  // --- passed to the user hook after every rarray/rmap (stats_alloc) and
+  //     before every del_rarray/del_rmap (stats_free) --- //
+  
+  struct rstats_event{
+    int what;            // rstats_what
+    int rank;
+    const void *data;    // first element of the data block
+    size_t data_bytes;   // 0 for rmap
+    size_t table_bytes;
+    bool file;           // data mapped from a file
+    double seconds;      // time spent in rarray/rmap, 0 for frees
+  };
+
+  typedef void (*rstats_hook)(rstats_event const& ev, void *user);
+  
+#ifdef RMEM_STATS
+  namespace detail{
+
+    typedef std::chrono::steady_clock rstat_clock;
+
+    // --- a hook and its user pointer, published together. Readers may
+    //     still hold a replaced pair, so they are kept and reused --- //
+    
+    struct rstat_hk{
+      rstats_hook hook;
+      void *user;
+      rstat_hk *next;
+    };
+    
+    struct rstat_ctr{
+      std::atomic<long> arrays, blocks;
+      std::atomic<size_t> data, table, file, live, peak;
+      std::atomic<long> count[stats_ranks];
+      std::atomic<long long> nsec[stats_ranks];
+      std::atomic<const rstat_hk*> hk;
+      std::mutex hm;              // taken by stats_hook only
+      rstat_hk *all;              // every pair ever installed
+    };
+
+    // --- zero-initialized before any dynamic initialization --- //
+    
+    inline rstat_ctr &rstat_get()
+    {
+      static rstat_ctr c;
+      return c;
+    }
+
+    // --- a new (sign = 1) or released (sign = -1) allocation --- //
+    
+    inline void rstat_block(int const& sign, size_t const& dbytes, size_t const& tbytes, bool const& file)
+    {
+      rstat_ctr &c = rstat_get();
+      std::atomic<size_t> &d = (file) ? c.file : c.data;
+      const size_t used = tbytes + ((file) ? 0 : dbytes);
+      
+      if(sign < 0){
+	--c.blocks, c.table -= tbytes, d -= dbytes, c.live -= used;
+	return;
+      }
+      
+      ++c.blocks, c.table += tbytes, d += dbytes;
+      const size_t now = (c.live += used);
+      size_t pk = c.peak.load();
+      while(pk < now && !c.peak.compare_exchange_weak(pk, now));
+    }
+
+    inline void rstat_array(int const& what, int const& rank, const void *data, size_t const& dbytes,
+			    size_t const& tbytes, bool const& file, rstat_clock::time_point const& t0)
+    {
+      rstat_ctr &c = rstat_get();
+      rstats_event ev = {what, rank, data, dbytes, tbytes, file, 0.};
+      
+      if(what == stats_alloc){
+	const long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(rstat_clock::now() - t0).count();
+	const int r = (rank < stats_ranks) ? rank : stats_ranks-1;
+	++c.arrays, ++c.count[r], c.nsec[r] += ns;
+	ev.seconds = ns*1.e-9;
+      }else --c.arrays;
+
+      const rstat_hk *hk = c.hk.load(std::memory_order_acquire);
+      if(hk) hk->hook(ev, hk->user);
+    }
+    
+  } // namespace detail
+#endif
+
+  // --- snapshot of the counters --- //
+  
+  inline rstats stats()
+  {
+    rstats s;
+    std::memset(&s, 0, sizeof(s));
+#ifdef RMEM_STATS
+    detail::rstat_ctr &c = detail::rstat_get();
+    s.arrays = c.arrays, s.blocks = c.blocks;
+    s.data_bytes = c.data, s.table_bytes = c.table, s.file_bytes = c.file, s.peak_bytes = c.peak;
+    for(int ii=0; ii<stats_ranks; ++ii) s.count[ii] = c.count[ii], s.seconds[ii] = c.nsec[ii]*1.e-9;
+#endif
+    return s;
+  }
+
+  // --- clears the per-rank counts and times and restarts the peak from
+  //     the current usage. The live totals are kept --- //
+  
+  inline void stats_reset()
+  {
+#ifdef RMEM_STATS
+    detail::rstat_ctr &c = detail::rstat_get();
+    for(int ii=0; ii<stats_ranks; ++ii) c.count[ii] = 0, c.nsec[ii] = 0;
+    c.peak = c.live.load();
+#endif
+  }
+
+  // --- installs a hook called from the allocating/releasing thread, NULL
+  //     removes it. The allocations read it without taking any lock --- //
+  
+  inline void stats_hook(rstats_hook hook, void *user = NULL)
+  {
+#ifdef RMEM_STATS
+    detail::rstat_ctr &c = detail::rstat_get();
+    std::lock_guard<std::mutex> lock(c.hm);
+    
+    detail::rstat_hk *h = NULL;
+    if(hook){
+      for(h = c.all; h && (h->hook != hook || h->user != user); h = h->next);
+      if(!h){
+	h = new detail::rstat_hk();
+	h->hook = hook, h->user = user, h->next = c.all, c.all = h;
+      }
+    }
+    c.hk.store(h, std::memory_order_release);
+#else
+    (void)hook, (void)user;
+#endif
+  }
+
+  // --- prints a snapshot, e.g. stats_dump(stderr) when a job runs out of memory --- //
+  
+  inline void stats_dump(FILE *f = stderr)
+  {
+#ifndef RMEM_STATS
+    fprintf(f, "rmem: statistics disabled, define RMEM_STATS to enable them\n");
+#else
+    const rstats s = stats();
+    const double mb = 1.0 / 1048576.0, used = double(s.data_bytes + s.table_bytes);
+    
+    fprintf(f, "rmem: %ld arrays in %ld blocks: data %.3f MB, tables %.3f MB (%.2f %%), files %.3f MB, peak %.3f MB\n",
+	    s.arrays, s.blocks, s.data_bytes*mb, s.table_bytes*mb, (used > 0) ? 100.*s.table_bytes/used : 0.,
+	    s.file_bytes*mb, s.peak_bytes*mb);
+    for(int ii=1; ii<stats_ranks; ++ii)
+      if(s.count[ii])
+	fprintf(f, "rmem:   rank %d%s: %ld allocations, %.6f s\n", ii, (ii == stats_ranks-1) ? "+" : "", s.count[ii], s.seconds[ii]);
+#endif
+  }
+
+  namespace detail{
+
+    // --- bookkeeping stored right before the outermost pointer table
+    //     (or before the data for 1D arrays) --- //
+    
+    enum rkind{rblock_heap = 0, rblock_mmap = 1, rblock_file = 2};
+
+    struct rpool;
+    struct rbucket;
+    
+    struct rhdr{
+      void *base;     // start of the allocation
+      size_t bytes;   // size of the allocation
+      void *data;     // first element of the data block
+      size_t n;       // number of elements in the data block
+      size_t tbytes;  // bytes used by the pointer tables
+      int kind;       // how the allocation was obtained (rkind)
+      void *mbase;    // separate mapping holding the data, if any
+      size_t mbytes;  // size of that mapping
+      rpool *pool;    // pool that owns the block, if any
+      rbucket *bk;    // cache of blocks with the same shape in that pool
+      rhdr *next;     // next cached block
+      uintptr_t tag;  // rhdr_tag(this), tells a header from other bytes
+#ifdef RMEM_STATS
+      size_t dbytes;  // bytes of the data block, for the statistics
+#endif
+    };
+
+    static const size_t hdr_size = 128;
+    static_assert(sizeof(rhdr) <= hdr_size, "rmem: the block header does not fit");
+
+    inline uintptr_t rhdr_tag(rhdr const* h)
+    {
+      return (uintptr_t)h ^ (uintptr_t)0x726d656d68647221ULL;
+    }
+
+    inline void rfail(std::string const& what)
+    {
+      throw std::runtime_error("rmem: " + what + ": " + std::strerror(errno));
+    }
+
+    /* --- 1D arrays keep the header right before the data. Those mapped
+           from a file offset that is not a multiple of the page size
+           cannot, as file bytes precede the data, and are looked up here
+           by the address of their first element. Their data is preceded
+           by an anonymous page, so the bytes in front of any 1D array can
+           be read to check for a tagged header without taking the lock --- */
+    
+    struct rreg{
+      std::mutex m;
+      std::map<void*, char*> t;
+      std::atomic<long> n;
+      rreg(): n(0){}
+    };
+
+    inline rreg &rreg_get()
+    {
+      static rreg r;
+      return r;
+    }
+
+    inline void rreg_add(void *d, char *t0)
+    {
+      rreg &r = rreg_get();
+      std::lock_guard<std::mutex> lock(r.m);
+      r.t[d] = t0, ++r.n;
+    }
+
+    inline void *rreg_take(void *d)
+    {
+      rreg &r = rreg_get();
+      if(r.n.load() == 0) return d;
+
+      // --- a misaligned address cannot hold a header, e.g. a 1D array
+      //     mapped from an odd file offset, so only the registry can --- //
+      
+      rhdr *h = (rhdr*)((char*)d - hdr_size);
+      if((uintptr_t)h % alignof(rhdr) == 0 && h->tag == rhdr_tag(h)) return d;
+      
+      std::lock_guard<std::mutex> lock(r.m);
+      std::map<void*, char*>::iterator it = r.t.find(d);
+      if(it == r.t.end()) return d;
+      
+      char *t0 = it->second;
+      r.t.erase(it), --r.n;
+      return t0;
+    }
+
+    inline char *align_up(char *p, size_t a)
+    {
+      return (char*)(((uintptr_t)p + a - 1) & ~(uintptr_t)(a - 1));
+    }
+
+    inline rhdr *get_hdr(void *t0)
+    {
+      return (rhdr*)((char*)t0 - hdr_size);
+    }
+    
+    inline size_t page_size()
+    {
+#ifdef RMEM_POSIX
+      static const size_t pg = sysconf(_SC_PAGESIZE);
+      return pg;
+#else
+      return 4096;
+#endif
+    }
+    
+    template<typename T> void rinit_fill(T *d, size_t const& n, rinit<T> const& in, std::false_type)
+    {
+      if(in.mode == rinit_value)     for(size_t ii=0; ii<n; ++ii) new (d+ii) T(in.value);
+      else if(in.mode == rinit_zero) for(size_t ii=0; ii<n; ++ii) new (d+ii) T();
+      else if(!std::is_trivial<T>::value) for(size_t ii=0; ii<n; ++ii) new (d+ii) T;
+    }
+
+    // --- elements that are C arrays (fixed extents), copied from in.value
+    //     which is zero unless a value was given --- //
+    
+    template<typename T> void rinit_fill(T *d, size_t const& n, rinit<T> const& in, std::true_type)
+    {
+      if(in.mode != rinit_none) for(size_t ii=0; ii<n; ++ii) std::memcpy(d+ii, &in.value, sizeof(T));
+    }
+    
+    template<typename T> void rinit_fill(T *d, size_t const& n, rinit<T> const& in)
+    {
+      rinit_fill(d, n, in, typename std::is_array<T>::type());
+    }
+
+    /* --- Initializes the block, made of nslab slabs, in parallel. Every
+           thread takes the slabs that a static OpenMP schedule over the
+           nslab slabs would give it, so every page is first touched by the
+           thread that will later process it. Uninitialized trivial types
+           only get one write per page: each thread touches the pages that
+           start within its range --- */
+    
+    template<typename T> void rinit_slabs(T *d, size_t const& n, long const& nslab, rinit<T> const& in)
+    {
+      const size_t ns = n / nslab, pg = page_size();
+      const bool touch = (in.mode == rinit_none) && std::is_trivial<T>::value;
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+      {
+#ifdef _OPENMP
+	const long nt = omp_get_num_threads(), id = omp_get_thread_num();
+#else
+	const long nt = 1, id = 0;
+#endif
+	const long q = nslab / nt, r = nslab % nt;
+	const long s0 = id*q + ((id < r) ? id : r), s1 = s0 + q + ((id < r) ? 1 : 0);
+	
+	if(touch){
+	  char *b = (char*)(d + s0*ns), *e = (char*)(d + s1*ns);
+	  if(id == 0 && b < e) *(volatile char*)b = 0;
+	  for(volatile char *c=align_up(b, pg); c<e; c+=pg) *c = 0;
+	}else if(s1 > s0) rinit_fill(d + s0*ns, (s1-s0)*ns, in);
+      }
+    }
+
+    // --- init policy of a whole block, by slabs if its placement matters --- //
+    
+    template<typename T> void rinit_block(T *d, size_t const& n, long const& nslab, rinit<T> const& in, ropt const& o)
+    {
+      if(o.numa != numa_none && nslab > 1) rinit_slabs(d, n, nslab, in);
+      else rinit_fill(d, n, in);
+    }
+
+    inline void rnuma_interleave(void *d, size_t const& bytes)
+    {
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_get_mempolicy)
+      // --- MPOL_INTERLEAVE over the nodes we are allowed to use
+      //     (MPOL_F_MEMS_ALLOWED). Silently ignored if not available --- //
+      
+      const unsigned long nbits = 1024;
+      unsigned long mask[nbits / (8*sizeof(unsigned long))] = {};
+      int mode = 0;
+      if(syscall(SYS_get_mempolicy, &mode, mask, nbits, NULL, 4) != 0) return;
+      
+      const size_t pg = page_size();
+      char *b = (char*)((uintptr_t)d & ~(uintptr_t)(pg-1));
+      syscall(SYS_mbind, b, (size_t)((char*)d + bytes - b), 3, mask, nbits+1, 0);
+#else
+      (void)d, (void)bytes;
+#endif
+    }
+
+    // --- anonymous mapping of bytes aligned to RMEM_HUGE_PAGE, with the
+    //     unaligned head and tail given back. bytes is rounded up --- //
+
+    inline char *rmap_huge(size_t &bytes)
+    {
+#ifdef RMEM_POSIX
+      const size_t hp = RMEM_HUGE_PAGE;
+      const size_t len = ((bytes + hp - 1) / hp) * hp;
+      char *m = (char*)mmap(NULL, len + hp, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+      if(m == (char*)MAP_FAILED) throw std::bad_alloc();
+
+      char *b = align_up(m, hp);
+      if(b > m) munmap(m, b-m);
+      if(m + hp > b) munmap(b + len, (m + hp) - b);
+#ifdef MADV_HUGEPAGE
+      madvise(b, len, MADV_HUGEPAGE);
+#endif
+      bytes = len;
+      return b;
+#else
+      (void)bytes;
+      return NULL;
+#endif
+    }
+    
+    // --- raw memory for a block: fresh pages from mmap when the data
+    //     placement or the page size matter, malloc otherwise --- //
+    
+    inline char *rblock_get(size_t &bytes, ropt const& o, int &kind)
+    {
+#ifdef RMEM_POSIX
+#ifdef MAP_HUGETLB
+      if(o.huge == huge_tlb){
+	const size_t hp = RMEM_HUGE_PAGE, len = ((bytes + hp - 1) / hp) * hp;
+	void *m = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+	if(m != MAP_FAILED){
+	  bytes = len, kind = rblock_mmap;
+	  return (char*)m;
+	}
+      }
+#endif
+      if(o.huge != huge_none){
+	kind = rblock_mmap;
+	return rmap_huge(bytes);
+      }
+      
+      if(o.numa != numa_none){
+	void *m = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(m == MAP_FAILED) throw std::bad_alloc();
+	kind = rblock_mmap;
+	return (char*)m;
+      }
+#endif
+      char *raw = (char*)std::malloc(bytes);
+      if(!raw) throw std::bad_alloc();
+      kind = rblock_heap;
+      return raw;
+    }
+
+    inline void rblock_release(rhdr *h)
+    {
+#ifdef RMEM_STATS
+      rstat_block(-1, h->dbytes, h->tbytes, h->kind == rblock_file);
+#endif
+#ifdef RMEM_POSIX
+      if(h->kind == rblock_file){
+	void *raw = h->base;   // NULL if the header lives in the mapping
+	munmap(h->mbase, h->mbytes);
+	std::free(raw);
+	return;
+      }
+      if(h->kind == rblock_mmap){
+	munmap(h->base, h->bytes);
+	return;
+      }
+#endif
+      std::free(h->base);
+    }
+
+    /* --- Header and pointer tables on the heap, data mapped from o.file.
+           1D arrays get an anonymous page in front of the file pages, which
+           holds the header when the data starts on a page boundary --- */
+    
+    template<typename T> T* rblock_map(size_t tbytes, size_t n, ropt const& o, char *&t0)
+    {
+#ifdef RMEM_POSIX
+      if(o.fmode != map_read && o.fmode != map_private && o.fmode != map_shared)
+	throw std::invalid_argument("rmem: unknown file mapping mode");
+      if(o.pad) throw std::invalid_argument("rmem: padded rows cannot be mapped from a file");
+      if(o.offset % alignof(T)) throw std::invalid_argument("rmem: the file offset is not aligned for this type");
+      
+      const size_t pg = page_size(), dbytes = n*sizeof(T);
+      const size_t off0 = o.offset - o.offset % pg, mbytes = dbytes + (o.offset - off0);
+      const bool rw = (o.fmode == map_shared);
+
+      const int flags = (rw) ? (O_RDWR | O_CREAT) : O_RDONLY;
+      int fd = (o.shm) ? shm_open(o.file, flags, 0644) : open(o.file, flags, 0644);
+      if(fd < 0) rfail(std::string("cannot open ") + o.file);
+
+      struct stat st;
+      if(fstat(fd, &st) != 0){ close(fd); rfail(std::string("cannot stat ") + o.file); }
+      if((size_t)st.st_size < o.offset + dbytes){
+	if(!rw || ftruncate(fd, o.offset + dbytes) != 0){
+	  close(fd);
+	  throw std::runtime_error(std::string("rmem: ") + o.file + " is too small for the requested array");
+	}
+      }
+      
+      const int prot = (o.fmode == map_read) ? PROT_READ : (PROT_READ|PROT_WRITE);
+      const size_t lead = (tbytes) ? 0 : pg;
+      char *a = NULL;
+      void *m;
+      if(lead){
+	void *r = mmap(NULL, lead + mbytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(r == MAP_FAILED){ close(fd); rfail(std::string("cannot map ") + o.file); }
+	a = (char*)r;
+	m = mmap(a + lead, mbytes, prot, ((rw) ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED, fd, off0);
+	if(m == MAP_FAILED){
+	  const int err = errno;
+	  munmap(a, lead + mbytes), close(fd), errno = err;
+	  rfail(std::string("cannot map ") + o.file);
+	}
+      }else m = mmap(NULL, mbytes, prot, (rw) ? MAP_SHARED : MAP_PRIVATE, fd, off0);
+      close(fd);
+      if(m == MAP_FAILED) rfail(std::string("cannot map ") + o.file);
+      
+      T *d = (T*)((char*)m + (o.offset - off0));
+      const bool front = (lead && o.offset == off0);
+      char *raw = NULL;
+      size_t bytes = 0;
+      
+      if(front) t0 = (char*)d;
+      else{
+	bytes = 2*hdr_size + tbytes;
+	raw = (char*)std::malloc(bytes);
+	if(!raw){ munmap((lead) ? (void*)a : m, lead + mbytes); throw std::bad_alloc(); }
+	t0 = align_up(raw + hdr_size, hdr_size);
+      }
+      
+      rhdr *h = get_hdr(t0);
+      h->base = raw, h->bytes = bytes, h->data = d, h->n = n, h->tbytes = tbytes, h->kind = rblock_file;
+      h->mbase = (lead) ? (void*)a : m, h->mbytes = lead + mbytes, h->pool = NULL, h->bk = NULL, h->next = NULL;
+      h->tag = rhdr_tag(h);
+#ifdef RMEM_STATS
+      h->dbytes = dbytes;
+      rstat_block(1, dbytes, tbytes, true);
+#endif
+
+      if(!tbytes && !front) rreg_add(d, t0);
+      return d;
+#else
+      (void)tbytes, (void)n, (void)o, (void)t0;
+      throw std::runtime_error("rmem: file mapping is not supported on this platform");
+#endif
+    }
+    
+    // --- allocates tbytes of pointer tables followed by n elements of
+    //     type T, split in nslab slabs along the outermost dimension.
+    //     On return t0 points to the first table entry (to the data for
+    //     1D arrays) --- //
+    
+    // --- checked before any pitch or offset is computed from o.align --- //
+    
+    inline void rcheck_align(ropt const& o)
+    {
+      if(o.align < sizeof(void*) || (o.align & (o.align-1)))
+	throw std::invalid_argument("rmem: the alignment must be a power of two");
+    }
+
+    // --- alignment of the data of T: o.align, or more if T needs it --- //
+    
+    template<typename T> size_t ralign(ropt const& o)
+    {
+      return std::max(o.align, (size_t)alignof(T));
+    }
+
+    // --- element and byte counts, which throw instead of wrapping --- //
+    
+    inline size_t rmul(size_t const& a, size_t const& b)
+    {
+      if(b && a > (size_t)std::numeric_limits<long>::max() / b) throw std::bad_array_new_length();
+      return a*b;
+    }
+    
+    inline size_t radd(size_t const& a, size_t const& b)
+    {
+      if(a > (size_t)std::numeric_limits<long>::max() - b) throw std::bad_array_new_length();
+      return a+b;
+    }
+    
+    template<typename T> T* rblock_alloc(size_t tbytes, size_t n, long nslab, rinit<T> const& in, ropt const& o, char *&t0)
+    {
+      if(o.file) return rblock_map<T>(tbytes, n, o, t0);
+      
+      rcheck_align(o);
+      const size_t align = ralign<T>(o);
+      
+      const size_t a = (align > hdr_size) ? align : hdr_size;
+      size_t bytes = radd(hdr_size + a + align, radd(tbytes, rmul(n, sizeof(T))));
+      int kind = rblock_heap;
+      char *raw = rblock_get(bytes, o, kind);
+      
+      t0 = align_up(raw + hdr_size, (tbytes) ? hdr_size : align);
+      T *d = (T*)align_up(t0 + tbytes, align);
+
+      rhdr *h = get_hdr(t0);
+      h->base = raw, h->bytes = bytes, h->data = d, h->n = n, h->tbytes = tbytes, h->kind = kind;
+      h->mbase = NULL, h->mbytes = 0, h->pool = NULL, h->bk = NULL, h->next = NULL;
+      h->tag = rhdr_tag(h);
+#ifdef RMEM_STATS
+      h->dbytes = n*sizeof(T);
+      rstat_block(1, h->dbytes, tbytes, false);
+#endif
+
+      if(o.numa == numa_interleave) rnuma_interleave(d, n*sizeof(T));
+      
+      rinit_block(d, n, nslab, in, o);
+      return d;
+    }
+
+    // --- number of elements between consecutive rows of length nx --- //
+    
+    template<typename T> long rpitch(ropt const& o, long const& nx)
+    {
+      if(!o.pad) return nx;
+      const size_t al = ralign<T>(o);
+      size_t a = al, b = sizeof(T);
+      while(b){ size_t tmp = a % b; a = b; b = tmp; }
+      const long step = al / a;
+      return ((nx + step - 1) / step) * step;
+    }
+
+    // ****************************************************************** //
+
+    /* --- Pool of freed blocks. Every thread has its own pool with one
+           bucket per (type, shape, options) key, so taking a block back
+           needs no locking. A block freed by another thread is pushed on
+           the owner's "remote" stack with a CAS and moved to its bucket by
+           the owner the next time that bucket is empty. A pool lives until
+           its thread exits and all the blocks it handed out are gone. A
+           bucket with no block cached or handed out is dropped by trims,
+           and when RMEM_POOL_BUCKETS buckets are in use new shapes are not
+           pooled --- */
+
+    struct rbucket{
+      const std::type_info *type;
+      std::vector<long> b;
+      size_t align;
+      bool pad;
+      int numa, huge;
+      rhdr *head;
+      long count;
+      long out;       // blocks handed out, updated by the owner only
+    };
+
+    struct rpool{
+      std::vector<rbucket*> bk;
+      rbucket *last;
+      std::atomic<rhdr*> remote;
+      std::atomic<bool> dead;
+      std::atomic<long> refs;
+      
+      rpool(): last(NULL), remote(NULL), dead(false), refs(1){}
+      ~rpool(){ for(size_t ii=0; ii<bk.size(); ++ii) delete bk[ii]; }
+    };
+
+    inline void rpool_unref(rpool *pl)
+    {
+      if(--pl->refs == 0) delete pl;
+    }
+    
+    inline void rpool_release(rhdr *h)
+    {
+      rpool *pl = h->pool;
+      rblock_release(h);
+      rpool_unref(pl);
+    }
+
+    inline void rpool_release_list(rhdr *h)
+    {
+      while(h){
+	rhdr *nx = h->next;
+	rpool_release(h);
+	h = nx;
+      }
+    }
+    
+    // --- drops the buckets that no block refers to any more --- //
+    
+    inline void rpool_compact(rpool *pl)
+    {
+      size_t kk = 0;
+      for(size_t ii=0; ii<pl->bk.size(); ++ii){
+	if(!pl->bk[ii]->head && !pl->bk[ii]->out) delete pl->bk[ii];
+	else pl->bk[kk++] = pl->bk[ii];
+      }
+      pl->bk.resize(kk);
+      pl->last = NULL;
+    }
+    
+    inline void rpool_trim(rpool *pl)
+    {
+      for(size_t ii=0; ii<pl->bk.size(); ++ii){
+	rhdr *h = pl->bk[ii]->head;
+	pl->bk[ii]->head = NULL, pl->bk[ii]->count = 0;
+	rpool_release_list(h);
+      }
+      rpool_compact(pl);
+    }
+
+    // --- owner side: move the blocks freed by other threads to their buckets --- //
+    
+    inline void rpool_drain(rpool *pl)
+    {
+      rhdr *h = pl->remote.exchange(NULL);
+      while(h){
+	rhdr *nx = h->next;
+	h->next = h->bk->head, h->bk->head = h, ++h->bk->count, --h->bk->out;
+	h = nx;
+      }
+    }
+
+    struct rpool_tls{
+      rpool *pl;
+      rpool_tls(): pl(NULL){}
+      ~rpool_tls()
+      {
+	if(!pl) return;
+	rpool *p = pl;
+	pl = NULL;
+	p->dead = true;
+	rpool_release_list(p->remote.exchange(NULL));
+	rpool_trim(p);
+	rpool_unref(p);
+      }
+    };
+
+    inline rpool *rpool_mine(bool const& create)
+    {
+      static thread_local rpool_tls tls;
+      if(!tls.pl && create) tls.pl = new rpool();
+      return tls.pl;
+    }
+    
+    inline bool rbucket_match(rbucket const* bk, std::type_info const& type, long const* b, int const& nb, ropt const& o)
+    {
+      if(*bk->type != type || (int)bk->b.size() != nb) return false;
+      if(bk->align != o.align || bk->pad != o.pad || bk->numa != o.numa || bk->huge != o.huge) return false;
+      for(int ii=0; ii<nb; ++ii) if(bk->b[ii] != b[ii]) return false;
+      return true;
+    }
+    
+    inline rbucket *rpool_bucket(rpool *pl, std::type_info const& type, long const* b, int const& nb, ropt const& o)
+    {
+      if(pl->last && rbucket_match(pl->last, type, b, nb, o)) return pl->last;
+      for(size_t ii=0; ii<pl->bk.size(); ++ii)
+	if(rbucket_match(pl->bk[ii], type, b, nb, o)) return (pl->last = pl->bk[ii]);
+
+      if(pl->bk.size() >= RMEM_POOL_BUCKETS) rpool_compact(pl);
+      if(pl->bk.size() >= RMEM_POOL_BUCKETS) return NULL;
+      
+      rbucket *bk = new rbucket();
+      bk->type = &type, bk->b.assign(b, b+nb);
+      bk->align = o.align, bk->pad = o.pad, bk->numa = o.numa, bk->huge = o.huge;
+      bk->head = NULL, bk->count = 0, bk->out = 0;
+      pl->bk.push_back(bk);
+      return (pl->last = bk);
+    }
+
+    /* --- Takes a cached block with bounds b[nb] and re-applies the init
+           policy to it, by slabs as a new block. Returns its t0, or NULL and the bucket in which the
+           newly allocated block must be registered with rpool_adopt --- */
+    
+    template<typename T> char *rpool_pop(long const* b, int const& nb, ropt const& o, rinit<T> const& in, rbucket *&bk)
+    {
+      rpool *pl = rpool_mine(true);
+      bk = rpool_bucket(pl, typeid(T), b, nb, o);
+      if(!bk) return NULL;
+      if(!bk->head && pl->remote.load()) rpool_drain(pl);
+      
+      rhdr *h = bk->head;
+      if(!h) return NULL;
+      
+      bk->head = h->next, --bk->count, ++bk->out;
+      h->next = NULL, bk = NULL;
+      rinit_block((T*)h->data, h->n, b[1]-b[0]+1, in, o);
+      return (char*)h + hdr_size;
+    }
+    
+    inline void rpool_adopt(char *t0, rbucket *bk)
+    {
+      rhdr *h = get_hdr(t0);
+      rpool *pl = rpool_mine(true);
+      h->pool = pl, h->bk = bk, ++pl->refs, ++bk->out;
+    }
+
+    inline void rpool_push(rhdr *h)
+    {
+      rpool *pl = h->pool;
+      
+      if(pl == rpool_mine(false)){
+	--h->bk->out;
+	if(h->bk->count >= RMEM_POOL_MAX) rpool_release(h);
+	else h->next = h->bk->head, h->bk->head = h, ++h->bk->count;
+	return;
+      }
+
+      // --- once h is on the stack the owner may exit and release it at
+      //     any time, our own reference keeps pl alive until we are done --- //
+      
+      ++pl->refs;
+      h->next = pl->remote.load();
+      while(!pl->remote.compare_exchange_weak(h->next, h));
+
+      // --- the owner is gone, nobody else will take it --- //
+      
+      if(pl->dead.load()) rpool_release_list(pl->remote.exchange(NULL));
+      rpool_unref(pl);
+    }
+    
+    // ****************************************************************** //
+    
+    template<typename T> void rdestroy(T *, size_t const&, std::true_type){}
+    template<typename T> void rdestroy(T *d, size_t const& n, std::false_type)
+    {
+      for(size_t ii=0; ii<n; ++ii) d[ii].~T();
+    }
+    
+    template<typename T> void rblock_free(void *t0)
+    {
+      rhdr *h = get_hdr(t0);
+      if(h->kind != rblock_file) rdestroy((T*)h->data, h->n, typename std::is_trivially_destructible<T>::type());
+      if(h->pool) rpool_push(h);
+      else rblock_release(h);
+    }
+    
+  } // namespace detail
+
+  // --- releases the blocks cached by the pool of the calling thread --- //
+  
+  inline void pool_trim()
+  {
+    detail::rpool *pl = detail::rpool_mine(false);
+    if(!pl) return;
+    detail::rpool_drain(pl);
+    detail::rpool_trim(pl);
+  }
+  
+  // --- removes the shared memory segment name, the arrays attached to it stay valid --- //
+  
+  inline void unlink_shared(const char *name)
+  {
+#ifdef RMEM_POSIX
+    if(shm_unlink(name) != 0) detail::rfail(std::string("cannot unlink ") + name);
+#else
+    (void)name;
+    throw std::runtime_error("rmem: shared memory is not supported on this platform");
+#endif
+  }
+  
+  /* --- Number of bytes of the mapping that contains addr that are backed
+         by huge pages, either hugetlbfs pages or transparent huge pages
+         (read from /proc/self/smaps, Linux only). Transparent huge pages
+         are only given when the memory is first touched --- */
+  
+  inline size_t huge_bytes(const void *addr)
+  {
+    size_t res = 0;
+#ifdef __linux__
+    FILE *f = fopen("/proc/self/smaps", "r");
+    if(!f) return 0;
+    
+    char line[512], perm[8];
+    unsigned long b = 0, e = 0, kb = 0, size = 0;
+    bool in = false;
+    
+    while(fgets(line, sizeof(line), f)){
+      if(sscanf(line, "%lx-%lx %7s", &b, &e, perm) == 3){
+	if(in) break;
+	in = ((uintptr_t)addr >= b) && ((uintptr_t)addr < e);
+      }else if(in){
+	if(sscanf(line, "Size: %lu kB", &kb) == 1) size = kb;
+	else if(sscanf(line, "KernelPageSize: %lu kB", &kb) == 1 && kb*1024 > detail::page_size()) res = size*1024;
+	else if(sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 && !res) res = kb*1024;
+      }
+    }
+    fclose(f);
+#else
+    (void)addr;
+#endif
+    return res;
+  }
+  
+  // ****************************************************************** //
+
+  // --- pointer type of an N-dimensional array: rptr<float,3>::type is float*** --- //
+  
+  template<typename T, int N> struct rptr{ typedef typename rptr<T,N-1>::type *type; };
+  template<typename T> struct rptr<T,0>{ typedef T type; };
+
+  // --- strips N pointer levels, the inverse of rptr --- //
+  
+  template<typename P, int N> struct rbase{ typedef typename rbase<typename std::remove_pointer<P>::type,N-1>::type type; };
+  template<typename P> struct rbase<P,0>{ typedef P type; };
+
+  template<typename P> struct rrank{ static const int value = 0; };
+  template<typename P> struct rrank<P*>{ static const int value = rrank<P>::value + 1; };
+  
+  // ****************************************************************** //
+
+  namespace detail{
+
+    // --- true if all the arguments convert to long (integers and
+    //     unscoped enums) and there are 2N of them --- //
+    
+    template<typename... L> struct rbounds;
+    template<> struct rbounds<>{ static const bool ints = true; };
+    template<typename L, typename... R> struct rbounds<L, R...>{
+      static const bool ints = std::is_convertible<L, long>::value && rbounds<R...>::ints;
+    };
+    
+    template<typename P, typename... L> struct renable
+      : std::enable_if<rbounds<L...>::ints && sizeof...(L) >= 2 && sizeof...(L) % 2 == 0, P>{};
+
+    /* --- Fills a pointer table level: d[ii] = b + ii*st (in bytes). This is
+           all the work of linking the tables, it vectorizes and runs in
+           parallel for large tables --- */
+    
+    inline void rfill(void **d, long const& m, char *b, long const& st)
+    {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(m >= RMEM_PAR_MIN)
+#endif
+      for(long ii=0; ii<m; ++ii) d[ii] = b + ii*st;
+    }
+    
+    /* --- Links the N-1 pointer tables stored from t0 onwards: every entry of
+           one level points to a row of the next one, and the last level to
+           rows of px elements of the data block v. lo and n are the lower
+           bounds and the extents of each dimension --- */
+    
+    template<typename T> void rlink(char *t0, T *v, long const* lo, long const* n, long const& px, int const& N)
+    {
+      void **lev = (void**)t0;
+      long m = 1;
+      
+      for(int kk=0; kk<N-1; ++kk){
+	m *= n[kk];
+	void **nxt = lev + m;
+	if(kk < N-2) rfill(lev, m, (char*)nxt - lo[kk+1]*sizeof(void*), n[kk+1]*sizeof(void*));
+	else         rfill(lev, m, (char*)v - lo[kk+1]*sizeof(T), px*sizeof(T));
+	lev = nxt;
+      }
+    }
+
+    // --- bytes taken by the pointer tables of an array with extents n --- //
+    
+    inline size_t rtable_bytes(long const* n, int const& N, long &rows)
+    {
+      size_t tb = 0;
+      rows = 1;
+      for(int kk=0; kk<N-1; ++kk){
+	rows = rmul(rows, n[kk]);
+	tb = radd(tb, rmul(rows, sizeof(void*)));
+      }
+      return tb;
+    }
+
+    // --- lower bounds and extents from the bounds b[2N], an upper bound
+    //     one below the lower one gives an empty dimension --- //
+    
+    inline void rextents(long const* b, int const& N, long *lo, long *n)
+    {
+      for(int kk=0; kk<N; ++kk){
+	if(b[2*kk+1] < b[2*kk] - 1) throw std::invalid_argument("rmem: an upper bound is below the lower bound");
+	lo[kk] = b[2*kk], n[kk] = b[2*kk+1]-b[2*kk]+1;
+      }
+    }
+    
+    // --- reports an array created from t0, or about to be released --- //
+    
+#ifdef RMEM_STATS
+    inline void rstat_array(int const& what, int const& rank, char *t0, rstat_clock::time_point const& ts)
+    {
+      rhdr *h = get_hdr(t0);
+      rstat_array(what, rank, h->data, h->dbytes, h->tbytes, h->kind == rblock_file, ts);
+    }
+#endif
+    
+    template<typename T, int N> typename rptr<T,N>::type rarray(ropt const& o, rinit<T> const& in, long const* b)
+    {
+#ifdef RMEM_STATS
+      const rstat_clock::time_point ts = rstat_clock::now();
+#endif
+      rcheck_align(o);
+      
+      long lo[N], n[N];
+      rextents(b, N, lo, n);
+
+      char *t0 = NULL;
+      rbucket *bk = NULL;
+      if(o.pool && !o.file) t0 = rpool_pop<T>(b, 2*N, o, in, bk);
+      
+      if(!t0){
+	const long px = (N > 1) ? rpitch<T>(o, n[N-1]) : n[N-1];
+	long rows;
+	const size_t tb = rtable_bytes(n, N, rows);
+      
+	T *v = rblock_alloc<T>(tb, rmul(rows, px), n[0], in, o, t0);
+	if(bk) rpool_adopt(t0, bk);
+	rlink<T>(t0, v, lo, n, px, N);
+      }
+      
+#ifdef RMEM_STATS
+      rstat_array(stats_alloc, N, t0, ts);
+#endif
+      return (typename rptr<T,N>::type)((N > 1) ? t0 : (char*)get_hdr(t0)->data) - lo[0];
+    }
+
+    template<typename T, int N> typename rptr<T,N>::type rmap(T *v, long const* b)
+    {
+#ifdef RMEM_STATS
+      const rstat_clock::time_point ts = rstat_clock::now();
+#endif
+      long lo[N], n[N];
+      rextents(b, N, lo, n);
+
+      long rows;
+      char *t0;
+      rblock_alloc<T>(rtable_bytes(n, N, rows), 0, 1, rinit<T>(uninit), ropt(), t0);
+      
+      rlink<T>(t0, v, lo, n, n[N-1], N);
+      get_hdr(t0)->data = v;
+#ifdef RMEM_STATS
+      rstat_array(stats_alloc, N, t0, ts);
+#endif
+      return (typename rptr<T,N>::type)t0 - lo[0];
+    }
+    
+  } // namespace detail
+  
+  // ****************************************************************** //
+
+  /* --- Allocates an array of any rank, rarray<T>(x1l, x1h, ..., xNl, xNh)
+         returns a T with N stars such that p[x1][x2]...[xN] is valid for
+         xkl <= xk <= xkh. The options and the init policy are optional --- */
+  
+  template<typename T, typename... L> typename detail::renable<typename rptr<T,sizeof...(L)/2>::type, L...>::type
+  rarray(ropt const& o, rinit<T> const& in, L const&... b)
+    {
+      const long bb[] = {long(b)...};
+      return detail::rarray<T, sizeof...(L)/2>(o, in, bb);
+    }
+  
+  template<typename T, typename... L> typename detail::renable<typename rptr<T,sizeof...(L)/2>::type, L...>::type
+  rarray(ropt const& o, L const&... b)
+    {
+      return rarray<T>(o, rinit<T>(), b...);
+    }
+
+  template<typename T, typename... L> typename detail::renable<typename rptr<T,sizeof...(L)/2>::type, L...>::type
+  rarray(rinit<T> const& in, L const&... b)
+    {
+      return rarray<T>(ropt(), in, b...);
+    }
+
+  template<typename T, typename... L> typename detail::renable<typename rptr<T,sizeof...(L)/2>::type, L...>::type
+  rarray(L const&... b)
+    {
+      return rarray<T>(ropt(), rinit<T>(), b...);
+    }
+
+  // --- releases an rarray, only the lower bound of the outermost
+  //     dimension is used but all of them are accepted. The element type
+  //     is deduced, or can be given as in del_rarray<float>(p, ...) --- //
+  
+  template<typename E = void, typename P, typename... L> void del_rarray(P *&p, long const& x1l, L const&...)
+    {
+      typedef typename rbase<P*, 1+sizeof...(L)>::type T;
+      static_assert(std::is_void<E>::value || std::is_same<E, T>::value, "rmem::del_rarray: the element type does not match the pointer");
+      void *t0 = (sizeof...(L) == 0) ? detail::rreg_take(p+x1l) : (void*)(p+x1l);
+#ifdef RMEM_STATS
+      detail::rstat_array(stats_free, 1+sizeof...(L), (char*)t0, detail::rstat_clock::time_point());
+#endif
+      detail::rblock_free<T>(t0);
+      p = NULL;
+    }
+
+  // ****************************************************************** //
+
+  /* --- Builds the pointer tables of an N > 1 dimensional array on top of
+         the contiguous block v, which is not copied nor released by
+         del_rmap --- */
+  
+  template<typename T, typename... L> typename detail::renable<typename rptr<T,sizeof...(L)/2>::type, L...>::type
+  rmap(T *v, L const&... b)
+    {
+      static_assert(sizeof...(L) >= 4, "rmem::rmap: at least two dimensions are needed");
+      const long bb[] = {long(b)...};
+      return detail::rmap<T, sizeof...(L)/2>(v, bb);
+    }
+
+  template<typename E = void, typename P, typename... L> void del_rmap(P *&p, long const& x1l, L const&...)
+    {
+      static_assert(std::is_void<E>::value || std::is_same<E, typename rbase<P*, 1+sizeof...(L)>::type>::value,
+		    "rmem::del_rmap: the element type does not match the pointer");
+#ifdef RMEM_STATS
+      detail::rstat_array(stats_free, 1+sizeof...(L), (char*)(p+x1l), detail::rstat_clock::time_point());
+#endif
+      detail::rblock_free<char>(p+x1l);
+      p = NULL;
+    }
+  
+  // ****************************************************************** //
+
+  namespace detail{
+
+    template<typename T, int N> struct rwalk{
+      static T* at(typename rptr<T,N>::type p, long const* i){ return rwalk<T,N-1>::at(p[i[0]], i+1); }
+    };
+    template<typename T> struct rwalk<T,1>{
+      static T* at(T *p, long const* i){ return p + i[0]; }
+    };
+
+    inline long roff_arr(long const* st, long const* i, int const& n)
+    {
+      long off = 0;
+      for(int ii=0; ii<n; ++ii) off += i[ii]*st[ii];
+      return off;
+    }
+
+    inline long roff(long const*){ return 0; }
+    template<typename... I> inline long roff(long const* st, long const& i, I const&... r)
+    {
+      return i*st[0] + roff(st+1, r...);
+    }
+    
+  } // namespace detail
+  
+  // ****************************************************************** //
+
+  /* --- Index range lo, lo+step, ... (<= hi) of one dimension for
+         hyperslabs. The selected elements are numbered consecutively
+         from lo, or from b if rebase(b) is given: range(2, 9, 3) makes
+         elements 2, 5 and 8 indexes 2, 3 and 4 --- */
+
+  struct rrange{
+    long lo, hi, step, base;
+
+    rrange(long const& lo_, long const& hi_, long const& step_ = 1):
+      lo(lo_), hi(hi_), step(step_), base(lo_){}
+
+    rrange &rebase(long const& b){ base = b; return *this; }
+  };
+
+  inline rrange range(long const& lo, long const& hi, long const& step = 1){ return rrange(lo, hi, step); }
+  
+  /* --- Pointer-free strided view of an N-dimensional array. It keeps
+         the address of element (0,...,0), the bounds and the stride
+         (in elements) of each dimension, so v(i,j,k) costs one multiply-add
+         per dimension and no dependent loads. It does not own the memory --- */
+  
+  template<typename T, int N> struct view{
+    T *o;
+    long lo[N], hi[N], st[N];
+
+    view(): o(NULL)
+    {
+      for(int ii=0; ii<N; ++ii) lo[ii] = 0, hi[ii] = -1, st[ii] = 0;
+    }
+
+    template<typename... I> T& operator()(I const&... i) const
+    {
+      static_assert(sizeof...(I) == N, "rmem::view: wrong number of indexes");
+      return o[detail::roff(st, i...)];
+    }
+    
+    long n(int const& d) const {return hi[d]-lo[d]+1;}
+    
+    long size() const
+    {
+      long nn = 1;
+      for(int ii=0; ii<N; ++ii) nn *= n(ii);
+      return nn;
+    }
+
+    T *data() const
+    {
+      return o + detail::roff_arr(st, lo, N);
+    }
+
+    /* --- Hyperslab of this view, one range per dimension, sharing its
+           memory. Element i of a dimension is element
+           r.lo + (i - r.base)*r.step of this view --- */
+    
+    template<typename... R> view<T,N> slab(R const&... r) const
+    {
+      static_assert(sizeof...(R) == N, "rmem::view: one range per dimension is needed");
+      const rrange rr[] = {rrange(r)...};
+      return slab(rr);
+    }
+    
+    view<T,N> slab(rrange const* r) const
+    {
+      view<T,N> v;
+      v.o = o;
+      for(int ii=0; ii<N; ++ii){
+	if(r[ii].step < 1 || r[ii].lo > r[ii].hi)
+	  throw std::invalid_argument("rmem::view: empty range or step < 1");
+	if(r[ii].lo < lo[ii] || r[ii].hi > hi[ii])
+	  throw std::out_of_range("rmem::view: the hyperslab exceeds the bounds");
+	
+	v.lo[ii] = r[ii].base, v.hi[ii] = r[ii].base + (r[ii].hi - r[ii].lo) / r[ii].step;
+	v.st[ii] = st[ii]*r[ii].step;
+	v.o += st[ii]*(r[ii].lo - r[ii].base*r[ii].step);
+      }
+      return v;
+    }
+  };
+
+  namespace detail{
+
+    // --- strides read from a pointer table of rank N --- //
+    
+    template<typename T, int N, bool table> struct rview_init{
+      static void run(view<T,N> &v, typename rptr<T,N>::type p)
+      {
+	long idx[N];
+	for(int ii=0; ii<N; ++ii) idx[ii] = v.lo[ii];
+	T *b0 = rwalk<T,N>::at(p, idx);
+	
+	for(int ii=N-1; ii>=0; --ii){
+	  if(v.hi[ii] > v.lo[ii]){
+	    idx[ii] += 1;
+	    v.st[ii] = rwalk<T,N>::at(p, idx) - b0;
+	    idx[ii] -= 1;
+	  }else v.st[ii] = (ii == N-1) ? 1 : v.st[ii+1]*v.n(ii+1);
+	}
+	v.o = b0;
+      }
+    };
+
+    // --- contiguous row-major block, as in rmap --- //
+    
+    template<typename T, int N> struct rview_init<T,N,false>{
+      static void run(view<T,N> &v, T *p)
+      {
+	v.st[N-1] = 1;
+	for(int ii=N-2; ii>=0; --ii) v.st[ii] = v.st[ii+1]*v.n(ii+1);
+	v.o = p;
+      }
+    };
+
+    // --- view of p over the bounds b[2N], p is a pointer table of rank N
+    //     or, if table is false, a contiguous block --- //
+    
+    template<typename T, int N, bool table, typename P> view<T,N> rview_make(P p, long const* b)
+    {
+      view<T,N> v;
+      for(int ii=0; ii<N; ++ii) v.lo[ii] = b[2*ii], v.hi[ii] = b[2*ii+1];
+      rview_init<T,N,table>::run(v, p);
+      v.o -= roff_arr(v.st, v.lo, N);
+      return v;
+    }
+    
+  } // namespace detail
+
+  /* --- Creates a view from an rarray/rmap pointer table of rank N or, as
+         in rmap, from a pointer to a contiguous block (for N > 1). The
+         strides are read from the pointer table, so padded rows are
+         honored --- */
+  
+  template<typename P, typename... L> view<typename rbase<P, (rrank<P>::value == 1) ? 1 : int(sizeof...(L)/2)>::type, sizeof...(L)/2> rview(P p, L const&... b)
+    {
+      static const int N = sizeof...(L)/2;
+      typedef typename rbase<P, (rrank<P>::value == 1) ? 1 : N>::type T;
+      static_assert(sizeof...(L) == 2*N, "rmem::rview: bounds must be given in pairs");
+      static_assert(rrank<P>::value == N || rrank<P>::value == 1, "rmem::rview: the pointer must be of rank N or point to a contiguous block");
+      
+      const long bb[] = {long(b)...};
+      return detail::rview_make<T,N,(rrank<P>::value == N)>(p, bb);
+    }
+
+  /* --- Zero-copy hyperslab of an rarray/rmap of rank N, e.g. a spatial
+         tile with every 2nd wavelength numbered from 0:
+
+           view<float,3> t = hyperslab(cube, range(0, nw-1, 2).rebase(0),
+                                       range(y0, y0+63), range(x0, x0+63));
+
+         The ranges must lie within the bounds of p, which the pointer
+         tables do not record. The view reads and writes the memory of p
+         and must not outlive it --- */
+  
+  template<typename P, typename... R> view<typename rbase<P, sizeof...(R)>::type, sizeof...(R)> hyperslab(P p, R const&... r)
+    {
+      static const int N = sizeof...(R);
+      typedef typename rbase<P, N>::type T;
+      static_assert(rrank<P>::value == N, "rmem::hyperslab: one range per dimension of the array is needed");
+      
+      const rrange rr[] = {rrange(r)...};
+      long bb[2*N];
+      for(int ii=0; ii<N; ++ii){
+	if(rr[ii].lo > rr[ii].hi) throw std::invalid_argument("rmem::hyperslab: empty range");
+	bb[2*ii] = rr[ii].lo, bb[2*ii+1] = rr[ii].hi;
+      }
+      
+      return detail::rview_make<T,N,true>(p, bb).slab(rr);
+    }
+  
+  // ****************************************************************** //
+
+  namespace detail{
+
+    // --- tiles used to reorder the two fastest axes: rtile_a elements
+    //     along the fastest axis of the destination times rtile_b along
+    //     that of the source. Long runs of contiguous writes matter most,
+    //     as the destination rows of a tile are often a power of two
+    //     apart. The in-place transpose uses square rtile x rtile tiles --- //
+    
+    static const long rtile_a = 256, rtile_b = 8, rtile = 32;
+
+    inline void rorder_check(int const* order, int const& N)
+    {
+      unsigned long seen = 0;
+      for(int d=0; d<N; ++d){
+	if(order[d] < 0 || order[d] >= N || (seen >> order[d]) & 1UL)
+	  throw std::invalid_argument("rmem::permute: the axis order is not a permutation");
+	seen |= 1UL << order[d];
+      }
+    }
+    
+    /* --- Copies tile [ib,ie) x [jb,je): d[j*db + i] = s[i*sa + j*sb]. The
+           full 8x8 blocks have constant extents so the compiler turns
+           them into register shuffles, unit is true for sb = 1 --- */
+    
+    template<typename T, bool unit> void rtile_copy(T *d, const T *s, long const& db, long const& sa, long const& sb_,
+						    long const& ib, long const& ie, long const& jb, long const& je)
+    {
+      const long sb = (unit) ? 1 : sb_;
+      long jj = jb;
+      for(; jj+8<=je; jj+=8){
+	long ii = ib;
+	for(; ii+8<=ie; ii+=8)
+	  for(int j8=0; j8<8; ++j8)
+	    for(int i8=0; i8<8; ++i8) d[(jj+j8)*db + ii+i8] = s[(ii+i8)*sa + (jj+j8)*sb];
+	for(; ii<ie; ++ii)
+	  for(int j8=0; j8<8; ++j8) d[(jj+j8)*db + ii] = s[ii*sa + (jj+j8)*sb];
+      }
+      for(; jj<je; ++jj)
+	for(long ii=ib; ii<ie; ++ii) d[jj*db + ii] = s[ii*sa + jj*sb];
+    }
+    
+    /* --- Copies v into the row-major block dst, whose dimension d is
+           dimension order[d] of v. When the fastest axis changes, the
+           plane of the two fastest axes (of dst and of v) is copied in
+           rtile_a x rtile_b tiles so both the reads and the writes stay in
+           cache. The tiles (or rows) are split among the threads --- */
+    
+    template<typename T, int N> void rpermute(T *dst, view<T,N> const& v, int const* order)
+    {
+      rorder_check(order, N);
+      
+      long n[N], dk[N], tot = 1;
+      for(int kk=0; kk<N; ++kk) n[kk] = v.n(kk);
+      for(int d=N-1; d>=0; --d) dk[order[d]] = tot, tot *= n[order[d]];
+      if(tot <= 0) return;
+
+      // --- a: fastest axis of dst, b: fastest axis of v --- //
+      
+      const int a = order[N-1], b = N-1;
+      int oth[N], no = 0;
+      for(int d=0; d<N; ++d) if(order[d] != a && order[d] != b) oth[no++] = order[d];
+
+      const long la = (a == b) ? n[a] : rtile_a, lb = (a == b) ? 1 : rtile_b;
+      const long ta = (n[a] + la - 1) / la, tb = (a == b) ? 1 : (n[b] + lb - 1) / lb;
+      long items = ta*tb;
+      for(int ii=0; ii<no; ++ii) items *= n[oth[ii]];
+
+      const T *s0 = v.data();
+      const long sa = v.st[a], sb = v.st[b], db = dk[b];
+      
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(tot >= RMEM_PAR_MIN)
+#endif
+      for(long it=0; it<items; ++it){
+	long r = it, so = 0, dof = 0;
+	const long jb = (r % tb)*lb; r /= tb;
+	const long ib = (r % ta)*la; r /= ta;
+	for(int ii=no-1; ii>=0; --ii){
+	  const long x = r % n[oth[ii]];
+	  r /= n[oth[ii]];
+	  so += x*v.st[oth[ii]], dof += x*dk[oth[ii]];
+	}
+	
+	const long ie = (ib + la < n[a]) ? ib + la : n[a];
+	const long je = (a == b) ? jb + 1 : ((jb + lb < n[b]) ? jb + lb : n[b]);
+	T *d = dst + dof;
+	const T *s = s0 + so;
+	
+	if(a == b){
+	  for(long ii=ib; ii<ie; ++ii) d[ii] = s[ii*sa];
+	  continue;
+	}
+
+	if(sb == 1) rtile_copy<T,true>(d, s, db, sa, sb, ib, ie, jb, je);
+	else rtile_copy<T,false>(d, s, db, sa, sb, ib, ie, jb, je);
+      }
+    }
+
+    // --- in-place transpose of a square 2D view, swapping tile (I,J) with (J,I) --- //
+    
+    template<typename T> void rtranspose(view<T,2> const& v)
+    {
+      const long n = v.n(0);
+      if(v.n(1) != n) throw std::invalid_argument("rmem::transpose: the array is not square");
+
+      T *o = v.data();
+      const long s0 = v.st[0], s1 = v.st[1], nt = (n + rtile - 1) / rtile;
+      
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) if(n*n >= RMEM_PAR_MIN)
+#endif
+      for(long ti=0; ti<nt; ++ti){
+	const long ie = (ti*rtile + rtile < n) ? ti*rtile + rtile : n;
+	for(long tj=ti; tj<nt; ++tj){
+	  const long je = (tj*rtile + rtile < n) ? tj*rtile + rtile : n;
+	  for(long ii=ti*rtile; ii<ie; ++ii)
+	    for(long jj=(ti == tj) ? ii+1 : tj*rtile; jj<je; ++jj){
+	      T tmp = o[ii*s0 + jj*s1];
+	      o[ii*s0 + jj*s1] = o[jj*s0 + ii*s1];
+	      o[jj*s0 + ii*s1] = tmp;
+	    }
+	}
+      }
+    }
+    
+  } // namespace detail
+
+  /* --- Axis permutation: dimension d of the result is dimension order[d]
+         of the source, e.g. order = {2,0,1} turns [y][x][lambda] into
+         [lambda][y][x]. dst is a contiguous row-major block of the same
+         number of elements (not overlapping the source), which rmap can
+         wrap directly. The source is a view, an rarray/rmap of rank N with
+         its bounds or, as in rmap, a contiguous block with its bounds --- */
+  
+  template<typename T, int N> void permute(T *dst, view<T,N> const& src, int const* order)
+    {
+      detail::rpermute<T,N>(dst, src, order);
+    }
+
+  template<typename T, typename P, typename... L> typename detail::renable<void, L...>::type
+  permute(T *dst, P src, int const* order, L const&... b)
+    {
+      permute(dst, rview(src, b...), order);
+    }
+
+  // --- the same into a new rarray with the permuted bounds --- //
+  
+  template<typename P, typename... L> typename detail::renable<P, L...>::type
+  rpermute(P src, int const* order, L const&... b)
+    {
+      static const int N = sizeof...(L)/2;
+      typedef typename rbase<P,N>::type T;
+      static_assert(rrank<P>::value == N, "rmem::rpermute: the pointer must be of rank N");
+      detail::rorder_check(order, N);
+
+      const long bb[] = {long(b)...};
+      long pb[2*N], lo[N];
+      for(int d=0; d<N; ++d) pb[2*d] = lo[d] = bb[2*order[d]], pb[2*d+1] = bb[2*order[d]+1];
+      
+      P q = detail::rarray<T,N>(ropt(), rinit<T>(uninit), pb);
+      permute(detail::rwalk<T,N>::at(q, lo), src, order, b...);
+      return q;
+    }
+
+  // --- in-place transpose of a square 2D rarray/rmap (or view), the bounds are kept --- //
+
+  template<typename T> void transpose(view<T,2> const& v)
+    {
+      detail::rtranspose<T>(v);
+    }
+  
+  template<typename T> void transpose(T **p, long const& x1l, long const& x1h, long const& x2l, long const& x2h)
+    {
+      detail::rtranspose<T>(rview(p, x1l, x1h, x2l, x2h));
+    }
+  
+  // ****************************************************************** //
+
+  namespace detail{
+
+    // --- element type of P seen as an N-dimensional array, as in rview --- //
+
+    template<typename P, int N> struct relem{
+      typedef typename rbase<P, (rrank<P>::value == 1) ? 1 : N>::type type;
+    };
+    
+    // --- elements processed per work item by the bulk operations --- //
+    
+    static const long rbulk_chunk = 16384;
+
+    // --- element-wise kernels, d is the destination and a, b the sources --- //
+    
+    template<typename D, typename A, typename B> struct rk_fill{
+      D v;
+      void operator()(D &d, A const&, B const&) const { d = v; }
+    };
+    template<typename D, typename A, typename B> struct rk_copy{
+      void operator()(D &d, A const& a, B const&) const { d = D(a); }
+    };
+    template<typename D, typename A, typename B> struct rk_scale{
+      D s;
+      void operator()(D &d, A const&, B const&) const { d = d*s; }
+    };
+    template<typename D, typename A, typename B> struct rk_axpy{
+      D s;
+      void operator()(D &d, A const& a, B const&) const { d = d + s*D(a); }
+    };
+    template<typename D, typename A, typename B> struct rk_min{
+      void operator()(D &d, A const& a, B const& b) const { d = D((b < a) ? b : a); }
+    };
+    template<typename D, typename A, typename B> struct rk_max{
+      void operator()(D &d, A const& a, B const& b) const { d = D((a < b) ? b : a); }
+    };
+
+    /* --- Applies k(d, a, b) to every element of three views of the same
+           shape. The fastest dimensions are merged while all three are
+           contiguous, so whole rarrays become a single run (rows when
+           one of them is padded), which is cut in chunks shared among the
+           threads. The unit-stride loop is the one the compiler vectorizes --- */
+    
+    template<typename K, typename D, typename A, typename B, int N>
+    void rbulk(K const& k, view<D,N> const& d, view<A,N> const& a, view<B,N> const& b)
+    {
+      for(int kk=0; kk<N; ++kk)
+	if(a.n(kk) != d.n(kk) || b.n(kk) != d.n(kk))
+	  throw std::invalid_argument("rmem: the arrays do not have the same shape");
+      
+      int in = N-1;
+      long len = d.n(N-1);
+      for(int kk=N-1; kk>0; --kk){
+	const long m = d.n(kk);
+	if(d.st[kk-1] != d.st[kk]*m || a.st[kk-1] != a.st[kk]*m || b.st[kk-1] != b.st[kk]*m) break;
+	len *= d.n(kk-1), in = kk-1;
+      }
+
+      long rows = 1;
+      for(int kk=0; kk<in; ++kk) rows *= d.n(kk);
+      if(rows <= 0 || len <= 0) return;
+      
+      const long nc = (len + rbulk_chunk - 1) / rbulk_chunk, items = rows*nc;
+      const long ds = d.st[N-1], as = a.st[N-1], bs = b.st[N-1];
+      D *d0 = d.data();
+      const A *a0 = a.data();
+      const B *b0 = b.data();
+      
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(rows*len >= RMEM_PAR_MIN)
+#endif
+      for(long it=0; it<items; ++it){
+	long r = it / nc, od = 0, oa = 0, ob = 0;
+	for(int kk=in-1; kk>=0; --kk){
+	  const long x = r % d.n(kk);
+	  r /= d.n(kk);
+	  od += x*d.st[kk], oa += x*a.st[kk], ob += x*b.st[kk];
+	}
+
+	const long i0 = (it % nc)*rbulk_chunk, m = (len - i0 < rbulk_chunk) ? len - i0 : rbulk_chunk;
+	D *pd = d0 + od + i0*ds;
+	const A *pa = a0 + oa + i0*as;
+	const B *pb = b0 + ob + i0*bs;
+	
+	if(ds == 1 && as == 1 && bs == 1) for(long ii=0; ii<m; ++ii) k(pd[ii], pa[ii], pb[ii]);
+	else for(long ii=0; ii<m; ++ii) k(pd[ii*ds], pa[ii*as], pb[ii*bs]);
+      }
+    }
+    
+  } // namespace detail
+
+  /* --- Bulk operations on whole arrays: the first argument(s) are
+         rarray/rmap pointers of rank N (or contiguous blocks, as in rmap)
+         followed by the bounds, which are the same for all of them.
+         The data blocks are processed with vectorized loops, in parallel
+         with OpenMP. The sources may be the destination itself --- */
+
+  // --- p[...] = v --- //
+  
+  template<typename P, typename V, typename... L> typename detail::renable<void, L...>::type
+  fill(P p, V const& v, L const&... b)
+    {
+      typedef typename detail::relem<P, sizeof...(L)/2>::type T;
+      const view<T, sizeof...(L)/2> d = rview(p, b...);
+      detail::rk_fill<T,T,T> k;
+      k.v = T(v);
+      detail::rbulk(k, d, d, d);
+    }
+
+  // --- dst[...] = src[...], converting the elements if the types differ
+  //     (e.g. int16_t to float or double to float) --- //
+  
+  template<typename P, typename Q, typename... L> typename detail::renable<void, L...>::type
+  copy(P dst, Q src, L const&... b)
+    {
+      typedef typename detail::relem<P, sizeof...(L)/2>::type D;
+      typedef typename detail::relem<Q, sizeof...(L)/2>::type S;
+      const view<D, sizeof...(L)/2> d = rview(dst, b...);
+      detail::rbulk(detail::rk_copy<D,S,S>(), d, rview(src, b...), rview(src, b...));
+    }
+
+  // --- p[...] *= s --- //
+  
+  template<typename P, typename V, typename... L> typename detail::renable<void, L...>::type
+  scale(P p, V const& s, L const&... b)
+    {
+      typedef typename detail::relem<P, sizeof...(L)/2>::type T;
+      const view<T, sizeof...(L)/2> d = rview(p, b...);
+      detail::rk_scale<T,T,T> k;
+      k.s = T(s);
+      detail::rbulk(k, d, d, d);
+    }
+
+  // --- y[...] += s*x[...] --- //
+  
+  template<typename P, typename V, typename Q, typename... L> typename detail::renable<void, L...>::type
+  axpy(P y, V const& s, Q x, L const&... b)
+    {
+      typedef typename detail::relem<P, sizeof...(L)/2>::type D;
+      typedef typename detail::relem<Q, sizeof...(L)/2>::type S;
+      detail::rk_axpy<D,S,S> k;
+      k.s = D(s);
+      detail::rbulk(k, rview(y, b...), rview(x, b...), rview(x, b...));
+    }
+
+  // --- dst[...] = min(a[...], b[...]) and max, element-wise --- //
+  
+  template<typename P, typename Q, typename R, typename... L> typename detail::renable<void, L...>::type
+  minimum(P dst, Q a, R b, L const&... bb)
+    {
+      typedef typename detail::relem<P, sizeof...(L)/2>::type D;
+      typedef typename detail::relem<Q, sizeof...(L)/2>::type A;
+      typedef typename detail::relem<R, sizeof...(L)/2>::type B;
+      detail::rbulk(detail::rk_min<D,A,B>(), rview(dst, bb...), rview(a, bb...), rview(b, bb...));
+    }
+
+  template<typename P, typename Q, typename R, typename... L> typename detail::renable<void, L...>::type
+  maximum(P dst, Q a, R b, L const&... bb)
+    {
+      typedef typename detail::relem<P, sizeof...(L)/2>::type D;
+      typedef typename detail::relem<Q, sizeof...(L)/2>::type A;
+      typedef typename detail::relem<R, sizeof...(L)/2>::type B;
+      detail::rbulk(detail::rk_max<D,A,B>(), rview(dst, bb...), rview(a, bb...), rview(b, bb...));
+    }
+  
+  // ****************************************************************** //
+
+  /* --- Reductions along one axis of an N-dimensional array. The result
+         has rank N-1 and the bounds of the other axes. reduce_argmax gives
+         the index (within the bounds of the axis) of the first maximum and
+         reduce_ksum a compensated (Kahan) sum, which -ffast-math defeats --- */
+
+  enum rreduce_op{reduce_sum = 0, reduce_mean = 1, reduce_min = 2, reduce_max = 3, reduce_argmax = 4, reduce_ksum = 5};
+  
+  namespace detail{
+
+    // --- output elements per work item when reducing a slow axis, and
+    //     independent accumulators when reducing the fastest one --- //
+    
+    static const long rred_chunk = 512;
+    static const int rred_lanes = 8;
+
+    template<typename R, typename V> void rkahan_add(R &s, R &c, V const& x)
+    {
+      const R y = R(x) - c, t = s + y;
+      c = (t - s) - y, s = t;
+    }
+
+    /* --- Reduces the nk elements s[k*sk] of one line (the axis is the
+           fastest varying one). Every lane takes one element out of
+           rred_lanes, so the loop vectorizes without reordering a
+           single sum --- */
+    
+    template<typename R, typename T> R rred_line(int const& op, const T *s, long const& sk, long const& nk, long const& k0)
+    {
+      const int L = rred_lanes;
+      const long m = (nk / L) * L;
+      
+      if(op == reduce_min || op == reduce_max || op == reduce_argmax){
+	T v[L];
+	long ix[L];
+	for(int jj=0; jj<L; ++jj) v[jj] = s[0], ix[jj] = 0;
+
+	if(op == reduce_min){
+	  for(long kk=0; kk<m; kk+=L)
+	    for(int jj=0; jj<L; ++jj){ const T x = s[(kk+jj)*sk]; v[jj] = (x < v[jj]) ? x : v[jj]; }
+	  for(long kk=m; kk<nk; ++kk) v[0] = (s[kk*sk] < v[0]) ? s[kk*sk] : v[0];
+	  for(int jj=1; jj<L; ++jj) v[0] = (v[jj] < v[0]) ? v[jj] : v[0];
+	  return R(v[0]);
+	}
+	if(op == reduce_max){
+	  for(long kk=0; kk<m; kk+=L)
+	    for(int jj=0; jj<L; ++jj){ const T x = s[(kk+jj)*sk]; v[jj] = (v[jj] < x) ? x : v[jj]; }
+	  for(long kk=m; kk<nk; ++kk) v[0] = (v[0] < s[kk*sk]) ? s[kk*sk] : v[0];
+	  for(int jj=1; jj<L; ++jj) v[0] = (v[0] < v[jj]) ? v[jj] : v[0];
+	  return R(v[0]);
+	}
+
+	for(long kk=0; kk<m; kk+=L)
+	  for(int jj=0; jj<L; ++jj){
+	    const T x = s[(kk+jj)*sk];
+	    const bool up = (v[jj] < x);
+	    v[jj] = (up) ? x : v[jj], ix[jj] = (up) ? kk+jj : ix[jj];
+	  }
+	for(long kk=m; kk<nk; ++kk) if(v[0] < s[kk*sk]) v[0] = s[kk*sk], ix[0] = kk;
+	for(int jj=1; jj<L; ++jj)
+	  if(v[0] < v[jj] || (!(v[jj] < v[0]) && ix[jj] < ix[0])) v[0] = v[jj], ix[0] = ix[jj];
+	return R(k0 + ix[0]);
+      }
+
+      R a[L], c[L];
+      for(int jj=0; jj<L; ++jj) a[jj] = R(0), c[jj] = R(0);
+      
+      if(op == reduce_ksum){
+	for(long kk=0; kk<m; kk+=L)
+	  for(int jj=0; jj<L; ++jj) rkahan_add(a[jj], c[jj], s[(kk+jj)*sk]);
+	for(long kk=m; kk<nk; ++kk) rkahan_add(a[0], c[0], s[kk*sk]);
+	for(int jj=1; jj<L; ++jj) rkahan_add(a[0], c[0], a[jj] - c[jj]);
+	return a[0] - c[0];
+      }
+      
+      for(long kk=0; kk<m; kk+=L)
+	for(int jj=0; jj<L; ++jj) a[jj] += R(s[(kk+jj)*sk]);
+      for(long kk=m; kk<nk; ++kk) a[0] += R(s[kk*sk]);
+      for(int jj=1; jj<L; ++jj) a[0] += a[jj];
+      return (op == reduce_mean) ? R(a[0] / R(nk)) : a[0];
+    }
+
+    /* --- Reduces nx lines at once along a slower axis: the nx elements
+           s[x*sx] of every slice k = 0..nk-1 (s + k*sk) are combined
+           into nx accumulators that stay in cache, so every element is
+           read once, in order, by a loop that vectorizes over x --- */
+    
+    template<typename R, typename T> void rred_block(int const& op, R *d, long const& sd, const T *s, long const& sx, long const& nx,
+						     long const& sk, long const& nk, long const& k0)
+    {
+      if(op == reduce_min || op == reduce_max || op == reduce_argmax){
+	T v[rred_chunk];
+	long ix[rred_chunk];
+	for(long xx=0; xx<nx; ++xx) v[xx] = s[xx*sx], ix[xx] = 0;
+
+	for(long kk=1; kk<nk; ++kk){
+	  const T *q = s + kk*sk;
+	  if(op == reduce_min)      for(long xx=0; xx<nx; ++xx){ const T x = q[xx*sx]; v[xx] = (x < v[xx]) ? x : v[xx]; }
+	  else if(op == reduce_max) for(long xx=0; xx<nx; ++xx){ const T x = q[xx*sx]; v[xx] = (v[xx] < x) ? x : v[xx]; }
+	  else for(long xx=0; xx<nx; ++xx){
+	      const T x = q[xx*sx];
+	      const bool up = (v[xx] < x);
+	      v[xx] = (up) ? x : v[xx], ix[xx] = (up) ? kk : ix[xx];
+	    }
+	}
+	
+	if(op == reduce_argmax) for(long xx=0; xx<nx; ++xx) d[xx*sd] = R(k0 + ix[xx]);
+	else                    for(long xx=0; xx<nx; ++xx) d[xx*sd] = R(v[xx]);
+	return;
+      }
+
+      R a[rred_chunk], c[rred_chunk];
+      for(long xx=0; xx<nx; ++xx) a[xx] = R(0), c[xx] = R(0);
+      
+      for(long kk=0; kk<nk; ++kk){
+	const T *q = s + kk*sk;
+	if(op == reduce_ksum) for(long xx=0; xx<nx; ++xx) rkahan_add(a[xx], c[xx], q[xx*sx]);
+	else                  for(long xx=0; xx<nx; ++xx) a[xx] += R(q[xx*sx]);
+      }
+
+      if(op == reduce_ksum)      for(long xx=0; xx<nx; ++xx) d[xx*sd] = a[xx] - c[xx];
+      else if(op == reduce_mean) for(long xx=0; xx<nx; ++xx) d[xx*sd] = R(a[xx] / R(nk));
+      else                       for(long xx=0; xx<nx; ++xx) d[xx*sd] = a[xx];
+    }
+
+    /* --- dst = reduction of src along axis. The work items are single
+           output elements when the axis is the fastest one and row
+           pieces of rred_chunk elements otherwise, split among the
+           threads --- */
+    
+    template<typename R, typename T, int N> void rreduce(view<R,N-1> const& dst, view<T,N> const& src, int const& op, int const& axis)
+    {
+      static_assert(N >= 2 && N <= 6, "rmem::reduce: only ranks 2 to 6 are supported");
+      static_assert(std::is_arithmetic<R>::value && std::is_arithmetic<T>::value, "rmem::reduce: arithmetic types are needed");
+      
+      if(axis < 0 || axis >= N) throw std::invalid_argument("rmem::reduce: the axis is out of range");
+      if(op < reduce_sum || op > reduce_ksum) throw std::invalid_argument("rmem::reduce: unknown operation");
+      for(int kk=0; kk<N; ++kk){
+	if(src.n(kk) < 1) throw std::invalid_argument("rmem::reduce: empty array");
+	if(kk == axis) continue;
+	const int jj = (kk < axis) ? kk : kk-1;
+	if(dst.lo[jj] != src.lo[kk] || dst.hi[jj] != src.hi[kk])
+	  throw std::invalid_argument("rmem::reduce: the bounds of the result do not match");
+      }
+
+      // --- source axes enumerated by the work items, and the matching
+      //     axes of the result --- //
+      
+      const bool fast = (axis == N-1);
+      int ax[N], dx[N], na = 0;
+      for(int kk=0; kk<N; ++kk)
+	if(kk != axis && (fast || kk != N-1)) ax[na] = kk, dx[na] = (kk < axis) ? kk : kk-1, ++na;
+
+      long rows = 1;
+      for(int ii=0; ii<na; ++ii) rows *= src.n(ax[ii]);
+      
+      const long nk = src.n(axis), sk = src.st[axis], k0 = src.lo[axis];
+      const long nx = (fast) ? 1 : src.n(N-1), nc = (nx + rred_chunk - 1) / rred_chunk, items = rows*nc;
+      const long sx = src.st[N-1], sd = dst.st[N-2];
+      const T *s0 = src.data();
+      R *d0 = dst.data();
+      
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(src.size() >= RMEM_PAR_MIN)
+#endif
+      for(long it=0; it<items; ++it){
+	long r = it / nc, os = 0, od = 0;
+	for(int ii=na-1; ii>=0; --ii){
+	  const long x = r % src.n(ax[ii]);
+	  r /= src.n(ax[ii]);
+	  os += x*src.st[ax[ii]], od += x*dst.st[dx[ii]];
+	}
+
+	if(fast){
+	  d0[od] = rred_line<R>(op, s0 + os, sk, nk, k0);
+	  continue;
+	}
+	
+	const long x0 = (it % nc)*rred_chunk, m = (nx - x0 < rred_chunk) ? nx - x0 : rred_chunk;
+	rred_block<R>(op, d0 + od + x0*sd, sd, s0 + os + x0*sx, sx, m, sk, nk, k0);
+      }
+    }
+
+    // --- view of a new rarray with the bounds of p except those of axis --- //
+    
+    template<typename T, int N> typename rptr<T,N-1>::type rred_alloc(long const* b, int const& axis, view<T,N-1> &v)
+    {
+      if(axis < 0 || axis >= N) throw std::invalid_argument("rmem::reduce: the axis is out of range");
+      for(int kk=0; kk<N; ++kk)
+	if(b[2*kk+1] < b[2*kk]) throw std::invalid_argument("rmem::reduce: empty array");
+      
+      long bb[2*N];
+      for(int kk=0, jj=0; kk<N; ++kk)
+	if(kk != axis) bb[2*jj] = b[2*kk], bb[2*jj+1] = b[2*kk+1], ++jj;
+
+      typename rptr<T,N-1>::type q = rarray<T,N-1>(ropt(), rinit<T>(uninit), bb);
+      v = rview_make<T,N-1,true>(q, bb);
+      return q;
+    }
+    
+  } // namespace detail
+
+  // --- into an existing array (or view) of rank N-1, of any arithmetic type --- //
+  
+  template<typename R, typename T, int N> void reduce(view<R,N-1> const& dst, view<T,N> const& src, int const& op, int const& axis)
+    {
+      detail::rreduce(dst, src, op, axis);
+    }
+
+  /* --- New rarray of rank N-1 with the reduction of p (an rarray/rmap of
+         rank N, followed by its bounds) along axis 0..N-1, e.g. the mean
+         spectrum of a cube p[y][x][w]:
+
+           float **m = rreduce(p, reduce_mean, 2, y0, y1, x0, x1, w0, w1);
+           del_rarray(m, y0, x0);
+  --- */
+  
+  template<typename P, typename... L> typename detail::renable<typename rptr<typename rbase<P, sizeof...(L)/2>::type, sizeof...(L)/2-1>::type, L...>::type
+  rreduce(P p, int const& op, int const& axis, L const&... b)
+    {
+      static const int N = sizeof...(L)/2;
+      typedef typename rbase<P,N>::type T;
+      static_assert(rrank<P>::value == N, "rmem::rreduce: one pair of bounds per dimension of the array is needed");
+      
+      if(op < reduce_sum || op > reduce_ksum) throw std::invalid_argument("rmem::reduce: unknown operation");
+      
+      const long bb[] = {long(b)...};
+      view<T,N-1> v;
+      typename rptr<T,N-1>::type q = detail::rred_alloc<T,N>(bb, axis, v);
+      detail::rreduce(v, rview(p, b...), op, axis);
+      return q;
+    }
+
+  // --- index of the first maximum along axis, as a new long array --- //
+  
+  template<typename P, typename... L> typename detail::renable<typename rptr<long, sizeof...(L)/2-1>::type, L...>::type
+  rargmax(P p, int const& axis, L const&... b)
+    {
+      static const int N = sizeof...(L)/2;
+      static_assert(rrank<P>::value == N, "rmem::rargmax: one pair of bounds per dimension of the array is needed");
+      
+      const long bb[] = {long(b)...};
+      view<long,N-1> v;
+      typename rptr<long,N-1>::type q = detail::rred_alloc<long,N>(bb, axis, v);
+      detail::rreduce(v, rview(p, b...), int(reduce_argmax), axis);
+      return q;
+    }
+  
+  // ****************************************************************** //
+
+  namespace detail{
+
+    /* --- Header of the files written by save: the shape and the element
+           type. It is padded to rio_data bytes so that the data starts on
+           a boundary that O_DIRECT accepts --- */
+
+    static const int rio_max_rank = 32;
+    static const size_t rio_data = 4096;
+    
+    struct rio_hdr{
+      char magic[8];                 // "rmemblk"
+      uint32_t endian;               // 0x01020304 as written by the host
+      uint32_t version;
+      int32_t rank;
+      int32_t esize;                 // sizeof(T)
+      char kind;                     // 'f'loat, 's'igned, 'u'nsigned or 'b'ytes
+      char unused[7];
+      uint64_t offset;               // first byte of the data
+      int64_t b[2*rio_max_rank];     // lower and upper bounds
+    };
+    static_assert(sizeof(rio_hdr) <= rio_data, "rmem: the file header does not fit");
+    
+    template<typename T> char rio_kind()
+    {
+      if(std::is_floating_point<T>::value) return 'f';
+      if(std::is_integral<T>::value) return (std::is_signed<T>::value) ? 's' : 'u';
+      return 'b';
+    }
+
+    // --- copies elements [e0, e0+m) of v, in row-major order, to (wr) or from buf --- //
+    
+    template<typename T, int N> void rio_stage(view<T,N> const& v, long const& e0, long const& m, T *buf, bool const& wr)
+    {
+      long idx[N], r = e0;
+      for(int kk=N-1; kk>=0; --kk) idx[kk] = v.lo[kk] + r % v.n(kk), r /= v.n(kk);
+
+      const long sx = v.st[N-1];
+      for(long ii=0; ii<m; ){
+	const long run = (v.hi[N-1] - idx[N-1] + 1 < m - ii) ? v.hi[N-1] - idx[N-1] + 1 : m - ii;
+	T *q = v.o + roff_arr(v.st, idx, N);
+	if(wr) for(long jj=0; jj<run; ++jj) buf[ii+jj] = q[jj*sx];
+	else   for(long jj=0; jj<run; ++jj) q[jj*sx] = buf[ii+jj];
+	
+	ii += run, idx[N-1] += run;
+	for(int kk=N-1; kk>0 && idx[kk] > v.hi[kk]; --kk) idx[kk] = v.lo[kk], ++idx[kk-1];
+      }
+    }
+
+#ifdef RMEM_POSIX
+    // --- full pread/pwrite of len bytes at off, retrying short transfers --- //
+    
+    inline bool rio_all(int const& fd, char *buf, size_t len, off_t off, bool const& wr)
+    {
+      while(len){
+	const ssize_t k = (wr) ? pwrite(fd, buf, len, off) : pread(fd, buf, len, off);
+	if(k < 0 && errno == EINTR) continue;
+	if(k <= 0){
+	  if(k == 0) errno = EIO;
+	  return false;
+	}
+	buf += k, len -= k, off += k;
+      }
+      return true;
+    }
+
+    /* --- Moves the data of v to (wr) or from the file, in chunks of
+           about RMEM_IO_CHUNK bytes handled by the OpenMP threads. Dense
+           blocks are transferred in place, padded ones (or unaligned ones
+           when fdd, the O_DIRECT descriptor, is used) through a per-thread
+           bounce buffer. The tail that is not a multiple of rio_data goes
+           through fd --- */
+    
+    template<typename T, int N> void rio_move(view<T,N> const& v, int const& fd, int const& fdd, bool const& wr)
+    {
+      bool dense = (v.st[N-1] == 1);
+      for(int kk=N-1; kk>0; --kk) dense = dense && (v.st[kk-1] == v.st[kk]*v.n(kk));
+
+      const long tot = v.size();
+      const size_t bytes = tot*sizeof(T), unit = rio_data*sizeof(T);
+      const size_t chunk = (RMEM_IO_CHUNK > unit) ? (RMEM_IO_CHUNK / unit) * unit : unit;
+      const long nc = (bytes + chunk - 1) / chunk;
+      char *mem = (char*)v.data();
+      std::atomic<int> err(0);
+      
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+      {
+	char *bounce = NULL;
+	
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+	for(long cc=0; cc<nc; ++cc){
+	  if(err.load()) continue;
+	  
+	  const size_t off = cc*chunk, len = (bytes - off < chunk) ? bytes - off : chunk;
+	  const size_t dlen = (fdd >= 0) ? len - len % rio_data : 0;
+	  char *buf = mem + off;
+	  
+	  if(!dense || (dlen && (uintptr_t)buf % rio_data)){
+	    if(!bounce && posix_memalign((void**)&bounce, rio_data, chunk)){
+	      err = ENOMEM;
+	      continue;
+	    }
+	    buf = bounce;
+	    if(wr) rio_stage(v, off/sizeof(T), len/sizeof(T), (T*)buf, true);
+	  }
+
+	  bool ok = true;
+	  if(dlen) ok = rio_all(fdd, buf, dlen, rio_data + off, wr);
+	  if(ok && len > dlen) ok = rio_all(fd, buf + dlen, len - dlen, rio_data + off + dlen, wr);
+	  if(!ok){
+	    err = errno;
+	    continue;
+	  }
+	  
+	  if(!wr && buf != mem + off) rio_stage(v, off/sizeof(T), len/sizeof(T), (T*)buf, false);
+	}
+	std::free(bounce);
+      }
+
+      if(err.load()){
+	errno = err.load();
+	rfail((wr) ? "cannot write the data" : "cannot read the data");
+      }
+    }
+
+    // --- second descriptor with O_DIRECT, -1 if not asked for or not supported --- //
+    
+    inline int rio_direct(const char *file, int const& flags, bool const& direct)
+    {
+#ifdef O_DIRECT
+      if(direct) return open(file, flags | O_DIRECT);
+#else
+      (void)file, (void)flags, (void)direct;
+#endif
+      return -1;
+    }
+#endif
+    
+    template<typename T, int N> void rio_save(ropt const& o, const char *file, view<T,N> const& v)
+    {
+      static_assert(N <= rio_max_rank, "rmem::save: rank too large for the file header");
+      static_assert(std::is_trivially_copyable<T>::value, "rmem::save: only trivially copyable types can be saved");
+#ifdef RMEM_POSIX
+      rio_hdr h;
+      std::memset(&h, 0, sizeof(h));
+      std::memcpy(h.magic, "rmemblk", 8);
+      h.endian = 0x01020304, h.version = 1, h.rank = N, h.esize = sizeof(T), h.kind = rio_kind<T>();
+      h.offset = rio_data;
+      for(int kk=0; kk<N; ++kk) h.b[2*kk] = v.lo[kk], h.b[2*kk+1] = v.hi[kk];
+
+      std::vector<char> head(rio_data, 0);
+      std::memcpy(&head[0], &h, sizeof(h));
+      
+      int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if(fd < 0) rfail(std::string("cannot create ") + file);
+      if(!rio_all(fd, &head[0], rio_data, 0, true) || ftruncate(fd, rio_data + v.size()*sizeof(T)) != 0){
+	const int e = errno;
+	close(fd);
+	errno = e;
+	rfail(std::string("cannot write ") + file);
+      }
+      
+      const int fdd = rio_direct(file, O_WRONLY, o.direct);
+      try{
+	rio_move(v, fd, fdd, true);
+      }catch(...){
+	close(fd);
+	if(fdd >= 0) close(fdd);
+	throw;
+      }
+      if(fdd >= 0) close(fdd);
+      if(close(fd) != 0) rfail(std::string("cannot write ") + file);
+#else
+      (void)o, (void)file, (void)v;
+      throw std::runtime_error("rmem: save is not supported on this platform");
+#endif
+    }
+
+    template<typename T, int N> typename rptr<T,N>::type rio_load(const char *file, long *b, ropt const& o)
+    {
+      static_assert(N <= rio_max_rank, "rmem::load: rank too large for the file header");
+      static_assert(std::is_trivially_copyable<T>::value, "rmem::load: only trivially copyable types can be loaded");
+#ifdef RMEM_POSIX
+      int fd = open(file, O_RDONLY);
+      if(fd < 0) rfail(std::string("cannot open ") + file);
 
-namespace rmem{
+      rio_hdr h;
+      if(!rio_all(fd, (char*)&h, sizeof(h), 0, false)){
+	close(fd);
+	throw std::runtime_error(std::string("rmem: ") + file + " is not an rmem file");
+      }
 
-  // ****************************************************************** //
+      const char *bad = NULL;
+      if(std::memcmp(h.magic, "rmemblk", 8) != 0 || h.version != 1) bad = " is not an rmem file";
+      else if(h.endian != 0x01020304) bad = " was written with another byte order";
+      else if(h.rank != N) bad = " holds an array of another rank";
+      else if(h.esize != (int)sizeof(T) || h.kind != rio_kind<T>()) bad = " holds another element type";
+      if(bad){
+	close(fd);
+	throw std::runtime_error(std::string("rmem: ") + file + bad);
+      }
+
+      // --- allocated without initialization, the data is read over it --- //
+      
+      ropt oo = o;
+      oo.file = NULL, oo.pool = false;
+      long bb[2*N];
+      for(int kk=0; kk<2*N; ++kk) bb[kk] = h.b[kk];
+      typename rptr<T,N>::type p = rarray<T,N>(oo, rinit<T>(uninit), bb);
+
+      const view<T,N> v = rview_make<T,N,true>(p, bb);
+
+      const int fdd = rio_direct(file, O_RDONLY, o.direct);
+      try{
+	rio_move(v, fd, fdd, false);
+      }catch(...){
+	close(fd);
+	if(fdd >= 0) close(fdd);
+#ifdef RMEM_STATS
+	rstat_array(stats_free, N, (char*)(p + bb[0]), rstat_clock::time_point());
+#endif
+	rblock_free<T>(p + bb[0]);
+	throw;
+      }
+      if(fdd >= 0) close(fdd);
+      close(fd);
+      
+      if(b) for(int kk=0; kk<2*N; ++kk) b[kk] = bb[kk];
+      return p;
+#else
+      (void)file, (void)b, (void)o;
+      throw std::runtime_error("rmem: load is not supported on this platform");
+#endif
+    }
+    
+  } // namespace detail
+
+  /* --- Writes an array, given by its pointer and bounds like rview, to a
+         file with a small header holding the bounds and the element type.
+         The data goes out with large pwrite calls from all the OpenMP
+         threads, with O_DIRECT if o.direct is set --- */
   
-  template<typename T> T* rarray(long const& x0, long const& x1)
+  template<typename P, typename... L> typename detail::renable<void, L...>::type
+  save(ropt const& o, const char *file, P p, L const&... b)
     {
-      return new T [x1-x0+1]() - x0;
+      detail::rio_save(o, file, rview(p, b...));
     }
-
-  template<typename T> void del_rarray(T *&v, long const& x0)
+  
+  template<typename P, typename... L> typename detail::renable<void, L...>::type
+  save(const char *file, P p, L const&... b)
+    {
+      detail::rio_save(ropt(), file, rview(p, b...));
+    }
+  
+  /* --- Reads a file written by save into a new rarray with the stored
+         bounds, which are returned in b[2N] if b is not NULL (release it
+         with del_rarray(p, b[0], ...)). The rank and the element type must
+         match p. The data block is not zeroed first, and o gives the
+         allocation options (o.direct for O_DIRECT reads) --- */
+  
+  template<typename P> void load(const char *file, P &p, long *b = NULL, ropt const& o = ropt())
     {
-      delete [] (v+x0);
-      v = NULL;
+      static const int N = rrank<P>::value;
+      p = detail::rio_load<typename rbase<P,N>::type, N>(file, b, o);
     }
   
   // ****************************************************************** //
 
-  template<typename T> T** rarray(long const& x0l, long const &x0h, long const& x1l, long const& x1h)
+  /* --- Out-of-core array of rank N stored on disk in tiles of fixed
+         extents (edge tiles are stored full size), of which at most
+         ntiles are kept in memory. The tiles are written one after the
+         other in row-major order of the tile grid, inside a tile the
+         elements are row-major too. Indexing follows the bounds given at
+         construction, as in rarray:
+
+           tiled<float,5> t("inv.tiles", {0,nt-1, 0,4, 0,nw-1, 0,ny-1, 0,nx-1},
+                            {1, 1, nw, 16, 16}, 256);
+           t(it, ip, iw, y, x) = v;
+
+         operator() marks the tile as modified, get() does not. The least
+         recently used tile is evicted when a new one is needed, and
+         written back first if modified and the file was opened with
+         map_shared (map_read never writes to the file). When consecutive
+         misses keep the same distance in tile index, the next ahead tiles
+         along that direction are requested from the kernel in advance.
+         References stay valid until the next access to another tile. It
+         is not thread-safe, use one per thread --- */
+
+  template<typename T, int N> class tiled{
+  public:
+    long lo[N], hi[N];
+    
+    tiled(const char *file, std::initializer_list<long> b, std::initializer_list<long> tile, size_t const& ntiles,
+	  int const& mode = map_shared, int const& ahead = 2):
+      fd(-1), wr(mode == map_shared), ra(ahead), mem(NULL), head(-1), tail(-1), used(0), cap((long)ntiles),
+      last(-1), lastp(NULL), lastslot(-1), miss(-1), stride(0)
     {
-      const long nx0 = x0h-x0l+1, nx1=x1h-x1l+1;
-      T **d = new T* [nx0] - x0l;
-      d[x0l] = new T [nx0*nx1] - x1l;
-      for(long x0=x0l+1;x0<=x0h; ++x0) d[x0] = d[x0-1] + nx1;
-      return d;
+      static_assert(std::is_trivially_copyable<T>::value, "rmem::tiled: only trivially copyable types can be tiled");
+      if((int)b.size() != 2*N || (int)tile.size() != N) throw std::invalid_argument("rmem::tiled: wrong number of bounds or tile extents");
+      if(cap < 1) throw std::invalid_argument("rmem::tiled: at least one tile must be cached");
+
+      tel = 1, tot = 1;
+      for(int kk=0; kk<N; ++kk){
+	lo[kk] = b.begin()[2*kk], hi[kk] = b.begin()[2*kk+1], tn[kk] = tile.begin()[kk];
+	if(tn[kk] < 1 || hi[kk] < lo[kk]) throw std::invalid_argument("rmem::tiled: empty tile or dimension");
+	nt[kk] = (n(kk) + tn[kk] - 1) / tn[kk];
+	tel *= tn[kk], tot *= nt[kk];
+      }
+      tbytes = tel*sizeof(T);
+      
+#ifdef RMEM_POSIX
+      fd = open(file, (wr) ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+      if(fd < 0) detail::rfail(std::string("cannot open ") + file);
+      
+      struct stat st;
+      if(fstat(fd, &st) != 0 || ((size_t)st.st_size < tot*tbytes && (!wr || ftruncate(fd, tot*tbytes) != 0))){
+	::close(fd);
+	throw std::runtime_error(std::string("rmem: ") + file + " is too small for the tiled array");
+      }
+#else
+      (void)file;
+      throw std::runtime_error("rmem: tiled arrays are not supported on this platform");
+#endif
+      if(cap > tot) cap = tot;
+      slot.assign(tot, -1);
+      id.assign(cap, -1), prev.assign(cap, -1), next.assign(cap, -1), dirty.assign(cap, 0);
+      
+      if(posix_memalign((void**)&mem, RMEM_ALIGN, cap*tbytes)){
+	::close(fd);
+	throw std::bad_alloc();
+      }
+    }
+
+    // --- a destructor cannot throw, so a failed write back is only
+    //     reported on stderr: call close() to get the error --- //
+    
+    ~tiled()
+    {
+#ifdef RMEM_POSIX
+      if(fd >= 0){
+	try{ flush(); }
+	catch(std::exception const& e){ fprintf(stderr, "rmem::tiled: modified tiles were lost, %s\n", e.what()); }
+	::close(fd);
+      }
+#endif
+      std::free(mem);
+    }
+    
+    tiled(tiled const&) = delete;
+    tiled &operator=(tiled const&) = delete;
+    
+    long n(int const& d) const {return hi[d]-lo[d]+1;}
+    
+    template<typename... I> T& operator()(I const&... i)
+    {
+      static_assert(sizeof...(I) == N, "rmem::tiled: wrong number of indexes");
+      const long ii[] = {long(i)...};
+      long t, o;
+      locate(ii, t, o);
+      T *p = fetch(t);
+      dirty[lastslot] = 1;
+      return p[o];
     }
 
-  template<typename T> void del_rarray(T **&v, long const &x0l, long const &x1l)
+    template<typename... I> T const& get(I const&... i)
     {
-      delete [] (v[x0l]+x1l);
-      delete [] (v+x0l);
-      v = NULL;
+      static_assert(sizeof...(I) == N, "rmem::tiled: wrong number of indexes");
+      const long ii[] = {long(i)...};
+      long t, o;
+      locate(ii, t, o);
+      return fetch(t)[o];
     }
 
-  // ****************************************************************** //
+    // --- writes all the modified tiles back (map_shared only) --- //
+    
+    void flush()
+    {
+      for(long s=0; s<used; ++s) writeback(s);
+    }
 
-  template<typename T> T*** rarray(long const& x1l, long const &x1h, long const& x2l, long const& x2h, long const& x3l, long const& x3h)
+    // --- flushes and closes the file, throwing if anything could not be
+    //     written. The array cannot be accessed afterwards --- //
+    
+    void close()
     {
-      const long nx1=x1h-x1l+1,nx2=x2h-x2l+1,nx3=x3h-x3l+1;
-      T ***p=new T** [nx1] - x1l;
-      p[x1l]=new T* [nx1*nx2] - x2l;
-      p[x1l][x2l]=new T [nx1*nx2*nx3]() - x3l;
-      for(long x2=x2l+1;x2<=x2h;++x2) p[x1l][x2]=p[x1l][x2-1]+nx3;
-      for(long x1=x1l+1;x1<=x1h;++x1){
-	p[x1]=p[x1-1]+nx2;
-	p[x1][x2l]=p[x1-1][x2l]+nx2*nx3;
-	for(long x2=x2l+1;x2<=x2h;++x2) p[x1][x2]=p[x1][x2-1]+nx3;
+#ifdef RMEM_POSIX
+      if(fd < 0) return;
+      flush();
+      const int f = fd;
+      fd = -1;
+      if(::close(f) != 0) detail::rfail("cannot write the tiled array");
+#endif
+    }
+    
+  private:
+    int fd;
+    bool wr;
+    int ra;
+    long tn[N], nt[N], tel, tot;
+    size_t tbytes;
+    T *mem;
+    std::vector<long> slot, id, prev, next;
+    std::vector<char> dirty;
+    long head, tail, used, cap;
+    long last;
+    T *lastp;
+    long lastslot, miss, stride;
+
+    void locate(long const* ii, long &t, long &o) const
+    {
+      t = 0, o = 0;
+      for(int kk=0; kk<N; ++kk){
+	const long x = ii[kk] - lo[kk], q = x / tn[kk];
+	t = t*nt[kk] + q, o = o*tn[kk] + (x - q*tn[kk]);
       }
-      return p;
     }
 
-  template <typename T> void del_rarray(T ***&p, long const& x1l, long const& x2l, long const& x3l)
+    void unlink_slot(long const& s)
     {
-      delete[] (p[x1l][x2l]+x3l);
-      delete[] (p[x1l]+x2l);
-      delete[] (p+x1l);
-      p = NULL;
+      if(prev[s] >= 0) next[prev[s]] = next[s];
+      else head = next[s];
+      if(next[s] >= 0) prev[next[s]] = prev[s];
+      else tail = prev[s];
     }
-  
-  // ****************************************************************** //
 
-  template <typename T> T**** rarray(long const& x1l,long const& x1h,long const& x2l,long const& x2h,long const& x3l,long const& x3h,long const& x4l,long const& x4h)
-    {
-      const long nx1=x1h-x1l+1,nx2=x2h-x2l+1,nx3=x3h-x3l+1,nx4=x4h-x4l+1;
-      double ****p = new T*** [nx1] - x1l;
-      p[x1l]=new T** [nx1*nx2] - x2l;
-      p[x1l][x2l]=new T* [nx1*nx2*nx3] - x3l;
-      p[x1l][x2l][x3l]=new T [nx1*nx2*nx3*nx4] - x4l;
-      for(long x3=x3l+1;x3<=x3h;++x3) p[x1l][x2l][x3]=p[x1l][x2l][x3-1]+nx4;
-      for(long x2=x2l+1;x2<=x2h;++x2){
-	p[x1l][x2]=p[x1l][x2-1]+nx3;
-	p[x1l][x2][x3l]=p[x1l][x2-1][x3l]+nx3*nx4;
-	for(long x3=x3l+1;x3<=x3h;++x3) p[x1l][x2][x3]=p[x1l][x2][x3-1]+nx4;
-      }
-      for(long x1=x1l+1;x1<=x1h;++x1) {
-	p[x1]=p[x1-1]+nx2;
-	p[x1][x2l]=p[x1-1][x2l]+nx2*nx3;
-	p[x1][x2l][x3l]=p[x1-1][x2l][x3l]+nx2*nx3*nx4;
-	for(long x3=x3l+1;x3<=x3h;++x3) p[x1][x2l][x3]=p[x1][x2l][x3-1]+nx4;
-	for(long x2=x2l+1;x2<=x2h;++x2){
-	  p[x1][x2]=p[x1][x2-1]+nx3;
-	  p[x1][x2][x3l]=p[x1][x2-1][x3l]+nx3*nx4;
-	  for(long x3=x3l+1;x3<=x3h;++x3) p[x1][x2][x3]=p[x1][x2][x3-1]+nx4;
+    void push_front(long const& s)
+    {
+      prev[s] = -1, next[s] = head;
+      if(head >= 0) prev[head] = s;
+      head = s;
+      if(tail < 0) tail = s;
+    }
+
+    void transfer(long const& s, bool const& out)
+    {
+#ifdef RMEM_POSIX
+      if(!detail::rio_all(fd, (char*)(mem + s*tel), tbytes, (off_t)(id[s]*tbytes), out))
+	detail::rfail((out) ? "cannot write a tile" : "cannot read a tile");
+#else
+      (void)s, (void)out;
+#endif
+    }
+
+    void writeback(long const& s)
+    {
+      if(!dirty[s]) return;
+      if(wr) transfer(s, true);
+      dirty[s] = 0;
+    }
+
+    // --- asks the kernel for the next ra tiles along the direction of the misses --- //
+    
+    void readahead(long const& t)
+    {
+      const long step = t - miss;
+      if(step != 0 && step == stride){
+#if defined(RMEM_POSIX) && defined(POSIX_FADV_WILLNEED)
+	for(long k=1; k<=ra; ++k){
+	  const long u = t + k*step;
+	  if(u < 0 || u >= tot) break;
+	  if(slot[u] < 0) posix_fadvise(fd, (off_t)(u*tbytes), tbytes, POSIX_FADV_WILLNEED);
 	}
+#endif
       }
-      return p;
+      stride = step, miss = t;
     }
-  
-
-  template<typename T> void del_rarray(T ****&p,  long const& x1l, long const& x2l, long const& x3l, long const& x4l)
+    
+    T *fetch(long const& t)
     {
-      delete[] (p[x1l][x2l][x3l]+x4l);
-      delete[] (p[x1l][x2l]+x3l);
-      delete[] (p[x1l]+x2l);
-      delete[] (p+x1l);
-      p = NULL;
+      if(t == last) return lastp;
+      
+      long s = slot[t];
+      if(s >= 0) unlink_slot(s);
+      else{
+	last = -1;
+	if(used < cap) s = used++;
+	else{
+	  s = tail;
+	  unlink_slot(s);
+	  try{ writeback(s); }catch(...){ push_front(s); throw; }
+	  if(id[s] >= 0) slot[id[s]] = -1;
+	}
+	
+	id[s] = t, slot[t] = s;
+	try{ transfer(s, false); }
+	catch(...){
+	  // --- leave the slot empty, at the end of the LRU list --- //
+	  slot[t] = -1, id[s] = -1;
+	  prev[s] = tail, next[s] = -1;
+	  if(tail >= 0) next[tail] = s;
+	  tail = s;
+	  if(head < 0) head = s;
+	  throw;
+	}
+	readahead(t);
+      }
+      
+      push_front(s);
+      last = t, lastslot = s, lastp = mem + s*tel;
+      return lastp;
     }
-  
+  };
   
   // ****************************************************************** //
 
-  template<typename T> T***** rarray(long const& x1l,long const& x1h,long const& x2l,long const& x2h,long const& x3l,long const& x3h,long const& x4l,long const& x4h,long const& x5l,long const& x5h)
-    {
-      const long nx1=x1h-x1l+1,nx2=x2h-x2l+1,nx3=x3h-x3l+1,nx4=x4h-x4l+1,nx5=x5h-x5l+1;
-      T *****p=new T**** [nx1] - x1l;
-      p[x1l]=new T*** [nx1*nx2] - x2l;
-      p[x1l][x2l]=new T** [nx1*nx2*nx3] - x3l;
-      p[x1l][x2l][x3l]=new T* [nx1*nx2*nx3*nx4] - x4l;
-      p[x1l][x2l][x3l][x4l]=new T [nx1*nx2*nx3*nx4*nx5]() - x5l;
-      for(long x4=x4l+1;x4<=x4h;++x4) p[x1l][x2l][x3l][x4]=p[x1l][x2l][x3l][x4-1]+nx5;
-      for(long x3=x3l+1;x3<=x3h;++x3){
-	p[x1l][x2l][x3]=p[x1l][x2l][x3-1]+nx4;    
-	p[x1l][x2l][x3][x4l]=p[x1l][x2l][x3-1][x4l]+nx4*nx5;
-	for(long x4=x4l+1;x4<=x4h;++x4) p[x1l][x2l][x3][x4]=p[x1l][x2l][x3][x4-1]+nx5;
-      }
-      for(long x2=x2l+1;x2<=x2h;++x2){
-	p[x1l][x2]=p[x1l][x2-1]+nx3;
-	p[x1l][x2][x3l]=p[x1l][x2-1][x3l]+nx3*nx4;
-	p[x1l][x2][x3l][x4l]=p[x1l][x2-1][x3l][x4l]+nx3*nx4*nx5;
-	for(long x4=x4l+1;x4<=x4h;++x4) p[x1l][x2][x3l][x4]=p[x1l][x2][x3l][x4-1]+nx5;
-	for(long x3=x3l+1;x3<=x3h;++x3){
-	  p[x1l][x2][x3]=p[x1l][x2][x3-1]+nx4;
-	  p[x1l][x2][x3][x4l]=p[x1l][x2][x3-1][x4l]+nx4*nx5;
-	  for(long x4=x4l+1;x4<=x4h;++x4) p[x1l][x2][x3][x4]=p[x1l][x2][x3][x4-1]+nx5;
-	}
-      }	
-      for(long x1=x1l+1;x1<=x1h;++x1) {
-	p[x1]=p[x1-1]+nx2;
-	p[x1][x2l]=p[x1-1][x2l]+nx2*nx3;
-	p[x1][x2l][x3l]=p[x1-1][x2l][x3l]+nx2*nx3*nx4;
-	p[x1][x2l][x3l][x4l]=p[x1-1][x2l][x3l][x4l]+nx2*nx3*nx4*nx5;
-	for(long x4=x4l+1;x4<=x4h;++x4) p[x1][x2l][x3l][x4]=p[x1][x2l][x3l][x4-1]+nx5;
-	for(long x3=x3l+1;x3<=x3h;++x3){
-	  p[x1][x2l][x3]=p[x1][x2l][x3-1]+nx4;
-	  p[x1][x2l][x3][x4l]=p[x1][x2l][x3-1][x4l]+nx4*nx5;
-	  for(long x4=x4l+1;x4<=x4h;++x4) p[x1][x2l][x3][x4]=p[x1][x2l][x3][x4-1]+nx5;
-	}
-	for(long x2=x2l+1;x2<=x2h;++x2){
-	  p[x1][x2]=p[x1][x2-1]+nx3;
-	  p[x1][x2][x3l]=p[x1][x2-1][x3l]+nx3*nx4;
-	  p[x1][x2][x3l][x4l]=p[x1][x2-1][x3l][x4l]+nx3*nx4*nx5;
-	  for(long x4=x4l+1;x4<=x4h;++x4) p[x1][x2][x3l][x4]=p[x1][x2][x3l][x4-1]+nx5;
-	  for(long x3=x3l+1;x3<=x3h;++x3){
-	    p[x1][x2][x3]=p[x1][x2][x3-1]+nx4;
-	    p[x1][x2][x3][x4l]=p[x1][x2][x3-1][x4l]+nx4*nx5;
-	    for(long x4=x4l+1;x4<=x4h;++x4) p[x1][x2][x3][x4]=p[x1][x2][x3][x4-1]+nx5;
+  /* --- 2D/3D array stored in square/cubic tiles of 2^L elements per
+         edge, tile after tile in row-major order of the tile grid and
+         row-major inside each tile, so that neighbours along every axis are
+         usually in the same few cache lines. The extents are rounded up to
+         whole tiles. Indexing is b(i,j,k) with the bounds of the array, as
+         rarray. It does not own the memory: create it with rblocked and
+         release it with del_blocked --- */
+  
+  template<typename T, int N, int L = (N == 2) ? 4 : 3> struct blocked{
+    static_assert(N == 2 || N == 3, "rmem::blocked: only ranks 2 and 3 are supported");
+    static const long B = 1L << L;
+    
+    T *d;
+    long lo[N], hi[N], nb[N];
+
+    blocked(): d(NULL)
+    {
+      for(int ii=0; ii<N; ++ii) lo[ii] = 0, hi[ii] = -1, nb[ii] = 0;
+    }
+    
+    template<typename... I> T& operator()(I const&... i) const
+    {
+      static_assert(sizeof...(I) == N, "rmem::blocked: wrong number of indexes");
+      const long ii[] = {long(i)...};
+      long t = 0, o = 0;
+      for(int kk=0; kk<N; ++kk){
+	const long x = ii[kk] - lo[kk];
+	t = t*nb[kk] + (x >> L), o = (o << L) | (x & (B-1));
+      }
+      return d[(t << (N*L)) | o];
+    }
+
+    long n(int const& dd) const {return hi[dd]-lo[dd]+1;}
+
+    // --- elements in the block, tiles rounded up --- //
+    
+    long size() const
+    {
+      long nn = 1;
+      for(int ii=0; ii<N; ++ii) nn *= nb[ii] << L;
+      return nn;
+    }
+  };
+
+  namespace detail{
+
+    // --- default tile edge: 16x16 in 2D, 8x8x8 in 3D --- //
+    
+    template<int N, int E> struct rblk_log{ static const int value = (E > 0) ? E : ((N == 2) ? 4 : 3); };
+
+    /* --- Copies between a blocked array and a strided view with the same
+           bounds (to_blk = true fills the blocked one). Every tile is
+           handled by one thread, row by row --- */
+    
+    template<typename T, int N, int L> void rblk_copy(blocked<T,N,L> const& b, view<T,N> const& v, bool const& to_blk)
+    {
+      const long B = blocked<T,N,L>::B, nrow = 1L << ((N-1)*L), sx = v.st[N-1];
+      long ntile = 1;
+      for(int kk=0; kk<N; ++kk) ntile *= b.nb[kk];
+      
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(ntile*(B << L) >= RMEM_PAR_MIN)
+#endif
+      for(long t=0; t<ntile; ++t){
+	long x0[N], r = t;
+	for(int kk=N-1; kk>=0; --kk) x0[kk] = b.lo[kk] + (r % b.nb[kk])*B, r /= b.nb[kk];
+	
+	const long ne = (b.hi[N-1] - x0[N-1] + 1 < B) ? b.hi[N-1] - x0[N-1] + 1 : B;
+	for(long rr=0; rr<nrow; ++rr){
+	  long x[N], q = rr;
+	  bool in = true;
+	  x[N-1] = x0[N-1];
+	  for(int kk=N-2; kk>=0; --kk){
+	    x[kk] = x0[kk] + (q & (B-1)), q >>= L;
+	    in = in && (x[kk] <= b.hi[kk]);
 	  }
+	  if(!in) continue;
+	  
+	  T *pb = b.d + ((t << (N*L)) | (rr << L));
+	  T *pv = v.o + roff_arr(v.st, x, N);
+	  if(to_blk) for(long jj=0; jj<ne; ++jj) pb[jj] = pv[jj*sx];
+	  else       for(long jj=0; jj<ne; ++jj) pv[jj*sx] = pb[jj];
 	}
       }
-      return p;
     }
+
+    template<typename T, int N, int L> view<T,N> rblk_view(blocked<T,N,L> const& b, typename rptr<T,N>::type p)
+    {
+      long bb[2*N];
+      for(int kk=0; kk<N; ++kk) bb[2*kk] = b.lo[kk], bb[2*kk+1] = b.hi[kk];
+      return rview_make<T,N,true>(p, bb);
+    }
+    
+  } // namespace detail
+
+  /* --- Allocates a blocked array, rblocked<T>(x1l, x1h, x2l, x2h[, x3l, x3h])
+         with the default tiles or rblocked<T,E> with tiles of 2^E elements
+         per edge. The data is zeroed unless an init policy is given --- */
   
-  template<typename T> void del_rarray(T *****&p, long const& x1l,long const& x2l,long const& x3l,long const& x4l,long const& x5l)
+  template<typename T, int E = 0, typename... L> typename detail::renable<blocked<T, sizeof...(L)/2, detail::rblk_log<sizeof...(L)/2, E>::value>, L...>::type
+  rblocked(rinit<T> const& in, L const&... b)
     {
-      delete[] (p[x1l][x2l][x3l][x4l]+x5l);
-      delete[] (p[x1l][x2l][x3l]+x4l);
-      delete[] (p[x1l][x2l]+x3l);
-      delete[] (p[x1l]+x2l);
-      delete[] (p+x1l);
-      p = NULL;
+      blocked<T, sizeof...(L)/2, detail::rblk_log<sizeof...(L)/2, E>::value> r;
+      const long bb[] = {long(b)...}, B = r.B;
+      long n[sizeof...(L)/2];
+      detail::rextents(bb, sizeof...(L)/2, r.lo, n);
+      for(int kk=0; kk<int(sizeof...(L)/2); ++kk){
+	r.hi[kk] = bb[2*kk+1];
+	r.nb[kk] = (n[kk] + B - 1) / B;
+      }
+      
+      char *t0;
+      r.d = detail::rblock_alloc<T>(0, r.size(), 1, in, ropt(), t0);
+      return r;
+    }
+
+  template<typename T, int E = 0, typename... L> typename detail::renable<blocked<T, sizeof...(L)/2, detail::rblk_log<sizeof...(L)/2, E>::value>, L...>::type
+  rblocked(L const&... b)
+    {
+      return rblocked<T,E>(rinit<T>(), b...);
+    }
+
+  template<typename T, int N, int L> void del_blocked(blocked<T,N,L> &b)
+    {
+      if(b.d) detail::rblock_free<T>(b.d);
+      b.d = NULL;
+    }
+
+  // --- conversions from/to an rarray/rmap (or view) with the same bounds --- //
+  
+  template<typename T, int N, int L> void to_blocked(blocked<T,N,L> const& dst, view<T,N> const& src)
+    {
+      detail::rblk_copy(dst, src, true);
+    }
+
+  template<typename T, int N, int L> void to_blocked(blocked<T,N,L> const& dst, typename rptr<T,N>::type src)
+    {
+      detail::rblk_copy(dst, detail::rblk_view(dst, src), true);
+    }
+  
+  template<typename T, int N, int L> void from_blocked(view<T,N> const& dst, blocked<T,N,L> const& src)
+    {
+      detail::rblk_copy(src, dst, false);
+    }
+
+  template<typename T, int N, int L> void from_blocked(typename rptr<T,N>::type dst, blocked<T,N,L> const& src)
+    {
+      detail::rblk_copy(src, detail::rblk_view(src, dst), false);
     }
   
   // ****************************************************************** //
+
+  /* --- Compile-time extents for the innermost axes. An axis is either
+         dyn (bounds given at run time) or fixed<NX, LO> (NX elements
+         indexed from LO). The fixed axes, which must come last, become
+         part of the element type: plain C arrays when LO = 0, farr
+         otherwise. They need no pointer table and loops over them have
+         constant trip counts:
+
+           float (**s)[4] = rarray<float, dyn, dyn, fixed<4>>(y0, y1, x0, x1);
+           s[y][x][k] ...
+           del_rarray(s, y0, x0);
+  --- */
+
+  struct dyn{};
+  template<long NX, long LO = 0> struct fixed{};
+
+  template<typename T, long NX, long LO> struct farr{
+    T v[NX];
+    T& operator[](long const& i){ return v[i-LO]; }
+    T const& operator[](long const& i) const { return v[i-LO]; }
+  };
+
+  namespace detail{
+
+    // --- checks that the dyn axes come first, counts them --- //
+    
+    template<bool F, typename... A> struct rfix_order{ static const bool ok = false; static const int nd = 0, nf = 0; };
+    template<bool F> struct rfix_order<F>{ static const bool ok = true; static const int nd = 0, nf = 0; };
+    template<bool F, typename... R> struct rfix_order<F, dyn, R...>{
+      static const bool ok = !F && rfix_order<F, R...>::ok;
+      static const int nd = 1 + rfix_order<F, R...>::nd, nf = rfix_order<F, R...>::nf;
+    };
+    template<bool F, long NX, long LO, typename... R> struct rfix_order<F, fixed<NX,LO>, R...>{
+      static const bool ok = (NX > 0) && rfix_order<true, R...>::ok;
+      static const int nd = rfix_order<true, R...>::nd, nf = 1 + rfix_order<true, R...>::nf;
+    };
+
+    // --- element type made of the fixed axes --- //
+    
+    template<typename T, typename... A> struct rfix_elem{ typedef T type; };
+    template<typename T, typename... R> struct rfix_elem<T, dyn, R...>{ typedef typename rfix_elem<T, R...>::type type; };
+    template<typename T, long NX, long LO, typename... R> struct rfix_elem<T, fixed<NX,LO>, R...>{
+      typedef typename rfix_elem<T, R...>::type in;
+      typedef typename std::conditional<LO == 0, in[NX], farr<in,NX,LO> >::type type;
+    };
+
+    template<typename T, typename... A> struct rfix{
+      static const int nd = rfix_order<false, A...>::nd;
+      static const bool ok = rfix_order<false, A...>::ok && nd > 0 && rfix_order<false, A...>::nf > 0;
+      typedef typename rfix_elem<T, A...>::type E;
+    };
+
+    template<typename P, typename F, typename... L> struct rfix_enable
+      : std::enable_if<F::ok && rbounds<L...>::ints && sizeof...(L) == 2*F::nd, P>{};
+    
+  } // namespace detail
+
+  // --- pointer type returned by rarray<T, A...> --- //
   
+  template<typename T, typename... A> struct rfixed{
+    typedef typename rptr<typename detail::rfix<T, A...>::E, detail::rfix<T, A...>::nd>::type type;
+  };
   
-  template<typename T> T ******rarray(long const& x1l,long const& x1h,long const& x2l,long const& x2h,long const& x3l,long const& x3h,long const& x4l,long const& x4h,long const& x5l,long const& x5h,long const& x6l,long const& x6h)
-    {
-      const long nx1=x1h-x1l+1,nx2=x2h-x2l+1,nx3=x3h-x3l+1,nx4=x4h-x4l+1,nx5=x5h-x5l+1,nx6=x6h-x6l+1;
-      T ******p;
-      p=new T***** [nx1] - x1l;
-      p[x1l]=new T**** [nx1*nx2] - x2l;
-      p[x1l][x2l]=new T*** [nx1*nx2*nx3] - x3l;
-      p[x1l][x2l][x3l]=new T** [nx1*nx2*nx3*nx4] - x4l;
-      p[x1l][x2l][x3l][x4l]=new T* [nx1*nx2*nx3*nx4*nx5] - x5l;
-      p[x1l][x2l][x3l][x4l][x5l]=new T [nx1*nx2*nx3*nx4*nx5*nx6]() - x6l;
-      for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2l][x3l][x4l][x5]=p[x1l][x2l][x3l][x4l][x5-1]+nx6;
-      for(long x4=x4l+1;x4<=x4h;++x4){
-	p[x1l][x2l][x3l][x4]=p[x1l][x2l][x3l][x4-1]+nx5;    
-	p[x1l][x2l][x3l][x4][x5l]=p[x1l][x2l][x3l][x4-1][x5l]+nx5*nx6;
-	for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2l][x3l][x4][x5]=p[x1l][x2l][x3l][x4][x5-1]+nx6;
-      }
-      for(long x3=x3l+1;x3<=x3h;++x3){
-	p[x1l][x2l][x3]=p[x1l][x2l][x3-1]+nx4;
-	p[x1l][x2l][x3][x4l]=p[x1l][x2l][x3-1][x4l]+nx4*nx5;
-	p[x1l][x2l][x3][x4l][x5l]=p[x1l][x2l][x3-1][x4l][x5l]+nx4*nx5*nx6;
-	for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2l][x3][x4l][x5]=p[x1l][x2l][x3][x4l][x5-1]+nx6;
-	for(long x4=x4l+1;x4<=x4h;++x4){
-	  p[x1l][x2l][x3][x4]=p[x1l][x2l][x3][x4-1]+nx5;    
-	  p[x1l][x2l][x3][x4][x5l]=p[x1l][x2l][x3][x4-1][x5l]+nx5*nx6;
-	  for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2l][x3][x4][x5]=p[x1l][x2l][x3][x4][x5-1]+nx6;
-	}
-      }
-      for(long x2=x2l+1;x2<=x2h;++x2){
-	p[x1l][x2]=p[x1l][x2-1]+nx3;
-	p[x1l][x2][x3l]=p[x1l][x2-1][x3l]+nx3*nx4;
-	p[x1l][x2][x3l][x4l]=p[x1l][x2-1][x3l][x4l]+nx3*nx4*nx5;
-	p[x1l][x2][x3l][x4l][x5l]=p[x1l][x2-1][x3l][x4l][x5l]+nx3*nx4*nx5*nx6;
-	for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2][x3l][x4l][x5]=p[x1l][x2][x3l][x4l][x5-1]+nx6;
-	for(long x4=x4l+1;x4<=x4h;++x4){
-	  p[x1l][x2][x3l][x4]=p[x1l][x2][x3l][x4-1]+nx5;    
-	  p[x1l][x2][x3l][x4][x5l]=p[x1l][x2][x3l][x4-1][x5l]+nx5*nx6;
-	  for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2][x3l][x4][x5]=p[x1l][x2][x3l][x4][x5-1]+nx6;
-	}
-	for(long x3=x3l+1;x3<=x3h;++x3){
-	  p[x1l][x2][x3]=p[x1l][x2][x3-1]+nx4;
-	  p[x1l][x2][x3][x4l]=p[x1l][x2][x3-1][x4l]+nx4*nx5;
-	  p[x1l][x2][x3][x4l][x5l]=p[x1l][x2][x3-1][x4l][x5l]+nx4*nx5*nx6;
-	  for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2][x3][x4l][x5]=p[x1l][x2][x3][x4l][x5-1]+nx6;
-	  for(long x4=x4l+1;x4<=x4h;++x4){
-	    p[x1l][x2][x3][x4]=p[x1l][x2][x3][x4-1]+nx5;    
-	    p[x1l][x2][x3][x4][x5l]=p[x1l][x2][x3][x4-1][x5l]+nx5*nx6;
-	    for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2][x3][x4][x5]=p[x1l][x2][x3][x4][x5-1]+nx6;
-	  }
-	}
-      }
-      for(long x1=x1l+1;x1<=x1h;++x1){
-	p[x1]=p[x1-1]+nx2;
-	p[x1][x2l]=p[x1-1][x2l]+nx2*nx3;
-	p[x1][x2l][x3l]=p[x1-1][x2l][x3l]+nx2*nx3*nx4;
-	p[x1][x2l][x3l][x4l]=p[x1-1][x2l][x3l][x4l]+nx2*nx3*nx4*nx5;
-	p[x1][x2l][x3l][x4l][x5l]=p[x1-1][x2l][x3l][x4l][x5l]+nx2*nx3*nx4*nx5*nx6;
-	for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2l][x3l][x4l][x5]=p[x1][x2l][x3l][x4l][x5-1]+nx6;
-	for(long x4=x4l+1;x4<=x4h;++x4){
-	  p[x1][x2l][x3l][x4]=p[x1][x2l][x3l][x4-1]+nx5;    
-	  p[x1][x2l][x3l][x4][x5l]=p[x1][x2l][x3l][x4-1][x5l]+nx5*nx6;
-	  for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2l][x3l][x4][x5]=p[x1][x2l][x3l][x4][x5-1]+nx6;
-	}
-	for(long x3=x3l+1;x3<=x3h;++x3){
-	  p[x1][x2l][x3]=p[x1][x2l][x3-1]+nx4;
-	  p[x1][x2l][x3][x4l]=p[x1][x2l][x3-1][x4l]+nx4*nx5;
-	  p[x1][x2l][x3][x4l][x5l]=p[x1][x2l][x3-1][x4l][x5l]+nx4*nx5*nx6;
-	  for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2l][x3][x4l][x5]=p[x1][x2l][x3][x4l][x5-1]+nx6;
-	  for(long x4=x4l+1;x4<=x4h;++x4){
-	    p[x1][x2l][x3][x4]=p[x1][x2l][x3][x4-1]+nx5;    
-	    p[x1][x2l][x3][x4][x5l]=p[x1][x2l][x3][x4-1][x5l]+nx5*nx6;
-	    for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2l][x3][x4][x5]=p[x1][x2l][x3][x4][x5-1]+nx6;
-	  }
-	}
-	for(long x2=x2l+1;x2<=x2h;++x2){
-	  p[x1][x2]=p[x1][x2-1]+nx3;
-	  p[x1][x2][x3l]=p[x1][x2-1][x3l]+nx3*nx4;
-	  p[x1][x2][x3l][x4l]=p[x1][x2-1][x3l][x4l]+nx3*nx4*nx5;
-	  p[x1][x2][x3l][x4l][x5l]=p[x1][x2-1][x3l][x4l][x5l]+nx3*nx4*nx5*nx6;
-	  for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2][x3l][x4l][x5]=p[x1][x2][x3l][x4l][x5-1]+nx6;
-	  for(long x4=x4l+1;x4<=x4h;++x4){
-	    p[x1][x2][x3l][x4]=p[x1][x2][x3l][x4-1]+nx5;    
-	    p[x1][x2][x3l][x4][x5l]=p[x1][x2][x3l][x4-1][x5l]+nx5*nx6;
-	    for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2][x3l][x4][x5]=p[x1][x2][x3l][x4][x5-1]+nx6;
-	  }
-	  for(long x3=x3l+1;x3<=x3h;++x3){
-	    p[x1][x2][x3]=p[x1][x2][x3-1]+nx4;
-	    p[x1][x2][x3][x4l]=p[x1][x2][x3-1][x4l]+nx4*nx5;
-	    p[x1][x2][x3][x4l][x5l]=p[x1][x2][x3-1][x4l][x5l]+nx4*nx5*nx6;
-	    for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2][x3][x4l][x5]=p[x1][x2][x3][x4l][x5-1]+nx6;
-	    for(long x4=x4l+1;x4<=x4h;++x4){
-	      p[x1][x2][x3][x4]=p[x1][x2][x3][x4-1]+nx5;    
-	      p[x1][x2][x3][x4][x5l]=p[x1][x2][x3][x4-1][x5l]+nx5*nx6;
-	      for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2][x3][x4][x5]=p[x1][x2][x3][x4][x5-1]+nx6;
-	    }
-	  }
-	}
+  template<typename T, typename... A, typename... L>
+  typename detail::rfix_enable<typename rfixed<T, A...>::type, detail::rfix<T, A...>, L...>::type
+  rarray(ropt const& o, rinit<T> const& in, L const&... b)
+    {
+      typedef detail::rfix<T, A...> F;
+      typedef typename F::E E;
+      static_assert(std::is_trivial<T>::value, "rmem::rarray: fixed extents need a trivial element type");
+
+      // --- allocated uninitialized as E, then initialized as scalars --- //
+      
+      const long bb[] = {long(b)...};
+      typename rfixed<T, A...>::type p = detail::rarray<E, F::nd>(o, rinit<E>(uninit), bb);
+      if(!o.file && in.mode != rinit_none){
+	detail::rhdr *h = detail::get_hdr((char*)(p + bb[0]));
+	detail::rinit_fill<T>((T*)h->data, h->n*(sizeof(E)/sizeof(T)), in);
       }
       return p;
     }
+
+  template<typename T, typename... A, typename... L>
+  typename detail::rfix_enable<typename rfixed<T, A...>::type, detail::rfix<T, A...>, L...>::type
+  rarray(ropt const& o, L const&... b)
+    {
+      return rarray<T, A...>(o, rinit<T>(), b...);
+    }
+
+  template<typename T, typename... A, typename... L>
+  typename detail::rfix_enable<typename rfixed<T, A...>::type, detail::rfix<T, A...>, L...>::type
+  rarray(rinit<T> const& in, L const&... b)
+    {
+      return rarray<T, A...>(ropt(), in, b...);
+    }
+
+  template<typename T, typename... A, typename... L>
+  typename detail::rfix_enable<typename rfixed<T, A...>::type, detail::rfix<T, A...>, L...>::type
+  rarray(L const&... b)
+    {
+      return rarray<T, A...>(ropt(), rinit<T>(), b...);
+    }
+
+  // --- rmap over a contiguous block of T, for two dyn axes or more --- //
   
-  template<typename T> void del_rarray(T ******&p,long const& x1l,long const& x2l,long const& x3l,long const& x4l,long const& x5l,long const& x6l)
-  {
-    delete[] (p[x1l][x2l][x3l][x4l][x5l]+x6l);
-    delete[] (p[x1l][x2l][x3l][x4l]+x5l);
-    delete[] (p[x1l][x2l][x3l]+x4l);
-    delete[] (p[x1l][x2l]+x3l);
-    delete[] (p[x1l]+x2l);
-    delete[] (p+x1l);
-    p = NULL;
-  }
-  
+  template<typename T, typename... A, typename... L>
+  typename detail::rfix_enable<typename rfixed<T, A...>::type, detail::rfix<T, A...>, L...>::type
+  rmap(T *v, L const&... b)
+    {
+      typedef typename detail::rfix<T, A...>::E E;
+      return rmap((E*)v, b...);
+    }
+
+
   // ****************************************************************** //
 
-  template<typename T> T** rmap(T *v, long const& x0l, long const &x0h, long const& x1l, long const& x1h)
-  {
-    const long nx0 = x0h-x0l+1, nx1=x1h-x1l+1;
-    T **d = new T* [nx0] - x0l;
-    d[x0l] = v - x1l;
-    for(long x0=x0l+1;x0<=x0h; ++x0) d[x0] = d[x0-1] + nx1;
-    return d;
-  }
-  
-  template<typename T> void del_rmap(T **&v, long const &x0l, long const &x1l)
-  {
-    //delete [] (v[x0l]+x1l);
-    delete [] (v+x0l);
-    v = NULL;
-  }
+  /* --- Structure of arrays: one array per field, all with the same
+         bounds and in a single block. Every field has its own pointer
+         tables, as rarray builds them, and its data starts on an o.align
+         boundary, so per-field loops run at full vector width and only
+         read the fields they use:
+
+           soa<3, float, float, double> m = rsoa<float, float, double>(z0, z1, y0, y1, x0, x1);
+           float ***temp = m.get<0>();
+           ...
+           del_soa(m);
 
-  // ***************************************************************** // 
+         It does not own the memory: create it with rsoa and release all
+         the fields at once with del_soa --- */
 
-  template<typename T> T*** rmap(T *v, long const& x1l, long const &x1h, long const& x2l, long const& x2h, long const& x3l, long const& x3h)
+  template<int N, typename... F> struct soa{
+    typedef std::tuple<typename rptr<F,N>::type...> fields;
+    static const int nf = sizeof...(F);
+    
+    fields f;
+    long lo[N], hi[N];
+    void *blk;     // allocation holding all the fields
+    ropt opt;      // options it was allocated with, which give the row pitches
+
+    soa(): f(), blk(NULL), opt()
+    {
+      for(int ii=0; ii<N; ++ii) lo[ii] = 0, hi[ii] = -1;
+    }
+
+    template<int I> typename std::tuple_element<I, fields>::type get() const { return std::get<I>(f); }
+    
+    long n(int const& dd) const {return hi[dd]-lo[dd]+1;}
+    
+    long size() const
     {
-      const long nx1=x1h-x1l+1,nx2=x2h-x2l+1,nx3=x3h-x3l+1;
-      T ***p=new T** [nx1] - x1l;
-      p[x1l]=new T* [nx1*nx2] - x2l;
-      p[x1l][x2l]= v - x3l;
-      for(long x2=x2l+1;x2<=x2h;++x2) p[x1l][x2]=p[x1l][x2-1]+nx3;
-      for(long x1=x1l+1;x1<=x1h;++x1){
-	p[x1]=p[x1-1]+nx2;
-	p[x1][x2l]=p[x1-1][x2l]+nx2*nx3;
-	for(long x2=x2l+1;x2<=x2h;++x2) p[x1][x2]=p[x1][x2-1]+nx3;
+      long nn = 1;
+      for(int ii=0; ii<N; ++ii) nn *= n(ii);
+      return nn;
+    }
+  };
+
+  namespace detail{
+
+    /* --- Lays out the fields I, I+1, ... of s: bytes() adds their size to
+           the offset off, link() builds their tables at t0 and their data
+           at d, and initializes it, destroy() runs the destructors of the
+           elements before the block is released --- */
+    
+    template<typename S, int N, int I = 0, bool last = (I == std::tuple_size<typename S::fields>::value)> struct rsoa_do{
+      typedef typename rbase<typename std::tuple_element<I, typename S::fields>::type, N>::type T;
+      typedef rsoa_do<S, N, I+1> next;
+      
+      static size_t align(ropt const& o)
+      {
+	return std::max(ralign<T>(o), next::align(o));
       }
-      return p;
+      
+      static size_t bytes(ropt const& o, long const* n, long const& rows, size_t off)
+      {
+	const long px = (N > 1) ? rpitch<T>(o, n[N-1]) : n[N-1];
+	const size_t al = ralign<T>(o);
+	off = radd(((off + al - 1) / al) * al, rmul(rmul(rows, px), sizeof(T)));
+	return next::bytes(o, n, rows, off);
+      }
+      
+      static void link(S &s, ropt const& o, rinit_mode const& mode, long const* n, long const& rows, size_t const& tb, char *t0, char *d)
+      {
+	const long px = (N > 1) ? rpitch<T>(o, n[N-1]) : n[N-1];
+	T *v = (T*)align_up(d, ralign<T>(o));
+	rinit<T> in;
+	in.mode = mode;
+	
+	rinit_block(v, rows*px, (N > 1) ? n[0] : 1, in, o);
+	
+	if(N > 1){
+	  rlink<T>(t0, v, s.lo, n, px, N);
+	  std::get<I>(s.f) = (typename std::tuple_element<I, typename S::fields>::type)t0 - s.lo[0];
+	}else std::get<I>(s.f) = (typename std::tuple_element<I, typename S::fields>::type)v - s.lo[0];
+	
+	next::link(s, o, mode, n, rows, tb, t0 + tb, (char*)(v + rows*px));
+      }
+
+      static void destroy(S &s, long const* n, long const& rows)
+      {
+	const long px = (N > 1) ? rpitch<T>(s.opt, n[N-1]) : n[N-1];
+	if(rows > 0 && px > 0) rdestroy(rwalk<T,N>::at(std::get<I>(s.f), s.lo), rows*px, typename std::is_trivially_destructible<T>::type());
+	next::destroy(s, n, rows);
+      }
+    };
+    
+    template<typename S, int N, int I> struct rsoa_do<S, N, I, true>{
+      static size_t align(ropt const& o){ return o.align; }
+      static size_t bytes(ropt const&, long const*, long const&, size_t off){ return off; }
+      static void link(S &, ropt const&, rinit_mode const&, long const*, long const&, size_t const&, char *, char *){}
+      static void destroy(S &, long const*, long const&){}
+    };
+
+    template<int N, typename... F> soa<N,F...> rsoa(ropt const& o, rinit_mode const& mode, long const* b)
+    {
+      typedef soa<N,F...> S;
+      if(o.file) throw std::invalid_argument("rmem::rsoa: the fields cannot be mapped from a file");
+      rcheck_align(o);
+
+      S s;
+      long n[N];
+      rextents(b, N, s.lo, n);
+      for(int kk=0; kk<N; ++kk) s.hi[kk] = b[2*kk+1];
+
+      // --- all the pointer tables first, then the data of every field --- //
+      
+      long rows;
+      const size_t tb = (N > 1) ? rtable_bytes(n, N, rows) : 0;
+      if(N == 1) rows = 1;
+      const size_t db = rsoa_do<S,N>::bytes(o, n, rows, 0);
+      
+      ropt oo = o;
+      oo.pool = false, oo.align = rsoa_do<S,N>::align(o);
+      char *t0;
+      char *d = rblock_alloc<char>(S::nf*tb, db, 1, rinit<char>(uninit), oo, t0);
+      
+      rsoa_do<S,N>::link(s, o, mode, n, rows, tb, t0, d);
+      s.blk = t0, s.opt = o;
+      return s;
+    }
+    
+    // --- element copies that also work for C array fields --- //
+    
+    template<typename E> void rsoa_set(E &d, E const& s){ d = s; }
+    template<typename E, size_t K> void rsoa_set(E (&d)[K], E const (&s)[K])
+    {
+      for(size_t kk=0; kk<K; ++kk) rsoa_set(d[kk], s[kk]);
     }
 
-  template <typename T> void del_rmap(T ***&p, long const& x1l, long const& x2l, long const& x3l)
+    // --- copies one row of every field named by the member pointers --- //
+    
+    template<int I, int N, typename Q, typename S> void rsoa_row(Q const&, S *, long const&, long const&, long const*, bool const&){}
+    
+    template<int I, int N, typename Q, typename S, typename T, typename... M>
+    void rsoa_row(Q const& f, S *a, long const& sa, long const& nx, long const* idx, bool const& to, T S::*m, M... r)
     {
-      //delete[] (p[x1l][x2l]+x3l);
-      delete[] (p[x1l]+x2l);
-      delete[] (p+x1l);
-      p = NULL;
+      typedef typename rbase<typename std::tuple_element<I,Q>::type, N>::type E;
+      static_assert(std::is_same<E, T>::value, "rmem::soa: the member does not have the type of the field");
+      
+      T *d = rwalk<T,N>::at(std::get<I>(f), idx);
+      if(to) for(long ii=0; ii<nx; ++ii) rsoa_set(d[ii], a[ii*sa].*m);
+      else   for(long ii=0; ii<nx; ++ii) rsoa_set(a[ii*sa].*m, d[ii]);
+      
+      rsoa_row<I+1,N>(f, a, sa, nx, idx, to, r...);
     }
 
-  // ***************************************************************** // 
-
-  template <typename T> T**** rmap(T *v, long const& x1l,long const& x1h,long const& x2l,long const& x2h,long const& x3l,long const& x3h,long const& x4l,long const& x4h)
-    {
-      const long nx1=x1h-x1l+1,nx2=x2h-x2l+1,nx3=x3h-x3l+1,nx4=x4h-x4l+1;
-      double ****p = new T*** [nx1] - x1l;
-      p[x1l]=new T** [nx1*nx2] - x2l;
-      p[x1l][x2l]=new T* [nx1*nx2*nx3] - x3l;
-      p[x1l][x2l][x3l] = v - x4l;
-      for(long x3=x3l+1;x3<=x3h;++x3) p[x1l][x2l][x3]=p[x1l][x2l][x3-1]+nx4;
-      for(long x2=x2l+1;x2<=x2h;++x2){
-	p[x1l][x2]=p[x1l][x2-1]+nx3;
-	p[x1l][x2][x3l]=p[x1l][x2-1][x3l]+nx3*nx4;
-	for(long x3=x3l+1;x3<=x3h;++x3) p[x1l][x2][x3]=p[x1l][x2][x3-1]+nx4;
-      }
-      for(long x1=x1l+1;x1<=x1h;++x1) {
-	p[x1]=p[x1-1]+nx2;
-	p[x1][x2l]=p[x1-1][x2l]+nx2*nx3;
-	p[x1][x2l][x3l]=p[x1-1][x2l][x3l]+nx2*nx3*nx4;
-	for(long x3=x3l+1;x3<=x3h;++x3) p[x1][x2l][x3]=p[x1][x2l][x3-1]+nx4;
-	for(long x2=x2l+1;x2<=x2h;++x2){
-	  p[x1][x2]=p[x1][x2-1]+nx3;
-	  p[x1][x2][x3l]=p[x1][x2-1][x3l]+nx3*nx4;
-	  for(long x3=x3l+1;x3<=x3h;++x3) p[x1][x2][x3]=p[x1][x2][x3-1]+nx4;
-	}
+    // --- copies between the fields of s and the members of the structs
+    //     of v, to_soa = true fills s --- //
+    
+    template<int N, typename... F, typename S, typename... M> void rsoa_copy(soa<N,F...> const& s, view<S,N> const& v, bool const& to_soa, M... m)
+    {
+      static_assert(sizeof...(M) == sizeof...(F), "rmem::soa: one member pointer per field is needed");
+      for(int kk=0; kk<N; ++kk)
+	if(v.lo[kk] != s.lo[kk] || v.hi[kk] != s.hi[kk])
+	  throw std::invalid_argument("rmem::soa: the bounds do not match");
+      
+      long rows = 1;
+      for(int kk=0; kk<N-1; ++kk) rows *= s.n(kk);
+      const long nx = s.n(N-1);
+      
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(rows*nx >= RMEM_PAR_MIN)
+#endif
+      for(long rr=0; rr<rows; ++rr){
+	long idx[N], q = rr;
+	idx[N-1] = s.lo[N-1];
+	for(int kk=N-2; kk>=0; --kk) idx[kk] = s.lo[kk] + q % s.n(kk), q /= s.n(kk);
+	
+	rsoa_row<0,N>(s.f, v.o + roff_arr(v.st, idx, N), v.st[N-1], nx, idx, to_soa, m...);
       }
-      return p;
     }
+    
+  } // namespace detail
+
+  /* --- Allocates a structure of arrays, rsoa<F1, F2, ...>(x1l, x1h, ...,
+         xNl, xNh) with one field of each type. The fields are zeroed
+         unless uninit is given. o.align, o.pad, o.numa and o.huge apply
+         to every field, o.pool is not used --- */
   
+  template<typename... F, typename... L> typename detail::renable<soa<sizeof...(L)/2, F...>, L...>::type
+  rsoa(ropt const& o, uninit_t const&, L const&... b)
+    {
+      const long bb[] = {long(b)...};
+      return detail::rsoa<sizeof...(L)/2, F...>(o, rinit_none, bb);
+    }
 
-  template<typename T> void del_rmap(T ****&p,  long const& x1l, long const& x2l, long const& x3l, long const& x4l)
+  template<typename... F, typename... L> typename detail::renable<soa<sizeof...(L)/2, F...>, L...>::type
+  rsoa(ropt const& o, L const&... b)
     {
-      //delete[] (p[x1l][x2l][x3l]+x4l);
-      delete[] (p[x1l][x2l]+x3l);
-      delete[] (p[x1l]+x2l);
-      delete[] (p+x1l);
-      p = NULL;
+      const long bb[] = {long(b)...};
+      return detail::rsoa<sizeof...(L)/2, F...>(o, rinit_zero, bb);
     }
   
-  // ***************************************************************** // 
-  template<typename T> T***** rmap(T *v, long const& x1l,long const& x1h,long const& x2l,long const& x2h,long const& x3l,long const& x3h,long const& x4l,long const& x4h,long const& x5l,long const& x5h)
-    {
-      const long nx1=x1h-x1l+1,nx2=x2h-x2l+1,nx3=x3h-x3l+1,nx4=x4h-x4l+1,nx5=x5h-x5l+1;
-      T *****p=new T**** [nx1] - x1l;
-      p[x1l]=new T*** [nx1*nx2] - x2l;
-      p[x1l][x2l]=new T** [nx1*nx2*nx3] - x3l;
-      p[x1l][x2l][x3l]=new T* [nx1*nx2*nx3*nx4] - x4l;
-      p[x1l][x2l][x3l][x4l]= v - x5l;
-      for(long x4=x4l+1;x4<=x4h;++x4) p[x1l][x2l][x3l][x4]=p[x1l][x2l][x3l][x4-1]+nx5;
-      for(long x3=x3l+1;x3<=x3h;++x3){
-	p[x1l][x2l][x3]=p[x1l][x2l][x3-1]+nx4;    
-	p[x1l][x2l][x3][x4l]=p[x1l][x2l][x3-1][x4l]+nx4*nx5;
-	for(long x4=x4l+1;x4<=x4h;++x4) p[x1l][x2l][x3][x4]=p[x1l][x2l][x3][x4-1]+nx5;
-      }
-      for(long x2=x2l+1;x2<=x2h;++x2){
-	p[x1l][x2]=p[x1l][x2-1]+nx3;
-	p[x1l][x2][x3l]=p[x1l][x2-1][x3l]+nx3*nx4;
-	p[x1l][x2][x3l][x4l]=p[x1l][x2-1][x3l][x4l]+nx3*nx4*nx5;
-	for(long x4=x4l+1;x4<=x4h;++x4) p[x1l][x2][x3l][x4]=p[x1l][x2][x3l][x4-1]+nx5;
-	for(long x3=x3l+1;x3<=x3h;++x3){
-	  p[x1l][x2][x3]=p[x1l][x2][x3-1]+nx4;
-	  p[x1l][x2][x3][x4l]=p[x1l][x2][x3-1][x4l]+nx4*nx5;
-	  for(long x4=x4l+1;x4<=x4h;++x4) p[x1l][x2][x3][x4]=p[x1l][x2][x3][x4-1]+nx5;
-	}
-      }	
-      for(long x1=x1l+1;x1<=x1h;++x1) {
-	p[x1]=p[x1-1]+nx2;
-	p[x1][x2l]=p[x1-1][x2l]+nx2*nx3;
-	p[x1][x2l][x3l]=p[x1-1][x2l][x3l]+nx2*nx3*nx4;
-	p[x1][x2l][x3l][x4l]=p[x1-1][x2l][x3l][x4l]+nx2*nx3*nx4*nx5;
-	for(long x4=x4l+1;x4<=x4h;++x4) p[x1][x2l][x3l][x4]=p[x1][x2l][x3l][x4-1]+nx5;
-	for(long x3=x3l+1;x3<=x3h;++x3){
-	  p[x1][x2l][x3]=p[x1][x2l][x3-1]+nx4;
-	  p[x1][x2l][x3][x4l]=p[x1][x2l][x3-1][x4l]+nx4*nx5;
-	  for(long x4=x4l+1;x4<=x4h;++x4) p[x1][x2l][x3][x4]=p[x1][x2l][x3][x4-1]+nx5;
-	}
-	for(long x2=x2l+1;x2<=x2h;++x2){
-	  p[x1][x2]=p[x1][x2-1]+nx3;
-	  p[x1][x2][x3l]=p[x1][x2-1][x3l]+nx3*nx4;
-	  p[x1][x2][x3l][x4l]=p[x1][x2-1][x3l][x4l]+nx3*nx4*nx5;
-	  for(long x4=x4l+1;x4<=x4h;++x4) p[x1][x2][x3l][x4]=p[x1][x2][x3l][x4-1]+nx5;
-	  for(long x3=x3l+1;x3<=x3h;++x3){
-	    p[x1][x2][x3]=p[x1][x2][x3-1]+nx4;
-	    p[x1][x2][x3][x4l]=p[x1][x2][x3-1][x4l]+nx4*nx5;
-	    for(long x4=x4l+1;x4<=x4h;++x4) p[x1][x2][x3][x4]=p[x1][x2][x3][x4-1]+nx5;
-	  }
-	}
+  template<typename... F, typename... L> typename detail::renable<soa<sizeof...(L)/2, F...>, L...>::type
+  rsoa(uninit_t const& u, L const&... b)
+    {
+      return rsoa<F...>(ropt(), u, b...);
+    }
+
+  template<typename... F, typename... L> typename detail::renable<soa<sizeof...(L)/2, F...>, L...>::type
+  rsoa(L const&... b)
+    {
+      return rsoa<F...>(ropt(), b...);
+    }
+
+  template<int N, typename... F> void del_soa(soa<N,F...> &s)
+    {
+      if(s.blk){
+	long n[N], rows = 1;
+	for(int kk=0; kk<N; ++kk) n[kk] = s.n(kk);
+	for(int kk=0; kk<N-1; ++kk) rows *= n[kk];
+	detail::rsoa_do<soa<N,F...>,N>::destroy(s, n, rows);
+	detail::rblock_free<char>(s.blk);
       }
-      return p;
+      s.f = typename soa<N,F...>::fields();
+      s.blk = NULL;
     }
+
+  /* --- Conversions from/to an array of structs with the same bounds,
+         one member pointer per field in the order of the fields:
+
+           to_soa(m, rview(points, z0, z1, y0, y1, x0, x1),
+                  &ModelPoint::temp, &ModelPoint::vel, &ModelPoint::b);
+  --- */
   
-  template<typename T> void del_rmap(T *****&p, long const& x1l,long const& x2l,long const& x3l,long const& x4l,long const& x5l)
+  template<int N, typename... F, typename S, typename... M> void to_soa(soa<N,F...> const& dst, view<S,N> const& src, M... m)
     {
-      // delete[] (p[x1l][x2l][x3l][x4l]+x5l);
-      delete[] (p[x1l][x2l][x3l]+x4l);
-      delete[] (p[x1l][x2l]+x3l);
-      delete[] (p[x1l]+x2l);
-      delete[] (p+x1l);
-      p = NULL;
+      detail::rsoa_copy(dst, src, true, m...);
+    }
+
+  template<int N, typename... F, typename S, typename... M> void from_soa(view<S,N> const& dst, soa<N,F...> const& src, M... m)
+    {
+      detail::rsoa_copy(src, dst, false, m...);
     }
 
+
   // ****************************************************************** //
-  
-  template<typename T> T ******rmap(T *v, long const& x1l,long const& x1h,long const& x2l,long const& x2h,long const& x3l,long const& x3h,long const& x4l,long const& x4h,long const& x5l,long const& x5h,long const& x6l,long const& x6h)
-    {
-      const long nx1=x1h-x1l+1,nx2=x2h-x2l+1,nx3=x3h-x3l+1,nx4=x4h-x4l+1,nx5=x5h-x5l+1,nx6=x6h-x6l+1;
-      T ******p;
-      p=new T***** [nx1] - x1l;
-      p[x1l]=new T**** [nx1*nx2] - x2l;
-      p[x1l][x2l]=new T*** [nx1*nx2*nx3] - x3l;
-      p[x1l][x2l][x3l]=new T** [nx1*nx2*nx3*nx4] - x4l;
-      p[x1l][x2l][x3l][x4l]=new T* [nx1*nx2*nx3*nx4*nx5] - x5l;
-      p[x1l][x2l][x3l][x4l][x5l]= v - x6l;
-      for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2l][x3l][x4l][x5]=p[x1l][x2l][x3l][x4l][x5-1]+nx6;
-      for(long x4=x4l+1;x4<=x4h;++x4){
-	p[x1l][x2l][x3l][x4]=p[x1l][x2l][x3l][x4-1]+nx5;    
-	p[x1l][x2l][x3l][x4][x5l]=p[x1l][x2l][x3l][x4-1][x5l]+nx5*nx6;
-	for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2l][x3l][x4][x5]=p[x1l][x2l][x3l][x4][x5-1]+nx6;
-      }
-      for(long x3=x3l+1;x3<=x3h;++x3){
-	p[x1l][x2l][x3]=p[x1l][x2l][x3-1]+nx4;
-	p[x1l][x2l][x3][x4l]=p[x1l][x2l][x3-1][x4l]+nx4*nx5;
-	p[x1l][x2l][x3][x4l][x5l]=p[x1l][x2l][x3-1][x4l][x5l]+nx4*nx5*nx6;
-	for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2l][x3][x4l][x5]=p[x1l][x2l][x3][x4l][x5-1]+nx6;
-	for(long x4=x4l+1;x4<=x4h;++x4){
-	  p[x1l][x2l][x3][x4]=p[x1l][x2l][x3][x4-1]+nx5;    
-	  p[x1l][x2l][x3][x4][x5l]=p[x1l][x2l][x3][x4-1][x5l]+nx5*nx6;
-	  for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2l][x3][x4][x5]=p[x1l][x2l][x3][x4][x5-1]+nx6;
-	}
+
+  /* --- 2D/3D domain split in blocks, one per thread, for stencils. Every
+         block is an rarray of its own, allocated and first touched by the
+         thread that owns it (block t goes with OpenMP thread t), that
+         covers the part of the domain it owns plus a halo of the given
+         width around it, all with the global indexes:
+
+           domain<float,3> d({z0, z1, y0, y1, x0, x1}, 2);
+           #pragma omp parallel
+           {
+             const int t = omp_get_thread_num();
+             float ***a = d.block(t);
+             for(int it=0; it<niter; ++it){
+               // ... update a[z][y][x] for d.blo(t,k) <= x_k <= d.bhi(t,k),
+               //     reading down to blo-2 and up to bhi+2
+               #pragma omp barrier
+               d.exchange(t);
+               #pragma omp barrier
+             }
+           }
+
+         The blocks form a grid that cuts the domain with the least
+         boundary area. exchange(t) copies into the halo of block t the
+         cells that other blocks own; halo cells outside the domain are
+         left alone for the boundary conditions. The blocks are separate
+         allocations, so no cache line written in a sweep is shared --- */
+
+  template<typename T, int N> class domain{
+  public:
+    typedef typename rptr<T,N>::type ptr;
+    long lo[N], hi[N];
+    
+    domain(std::initializer_list<long> b, int const& halo, int const& nblocks = 0, ropt const& o = ropt()):
+      h(halo), nb(nblocks)
+    {
+      static_assert(N == 2 || N == 3, "rmem::domain: only ranks 2 and 3 are supported");
+      if((int)b.size() != 2*N) throw std::invalid_argument("rmem::domain: wrong number of bounds");
+      if(h < 0) throw std::invalid_argument("rmem::domain: negative halo width");
+      if(o.file) throw std::invalid_argument("rmem::domain: the blocks cannot be mapped from a file");
+      
+      long cells = 1;
+      for(int kk=0; kk<N; ++kk){
+	lo[kk] = b.begin()[2*kk], hi[kk] = b.begin()[2*kk+1];
+	if(hi[kk] < lo[kk]) throw std::invalid_argument("rmem::domain: empty dimension");
+	cells *= n(kk);
       }
-      for(long x2=x2l+1;x2<=x2h;++x2){
-	p[x1l][x2]=p[x1l][x2-1]+nx3;
-	p[x1l][x2][x3l]=p[x1l][x2-1][x3l]+nx3*nx4;
-	p[x1l][x2][x3l][x4l]=p[x1l][x2-1][x3l][x4l]+nx3*nx4*nx5;
-	p[x1l][x2][x3l][x4l][x5l]=p[x1l][x2-1][x3l][x4l][x5l]+nx3*nx4*nx5*nx6;
-	for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2][x3l][x4l][x5]=p[x1l][x2][x3l][x4l][x5-1]+nx6;
-	for(long x4=x4l+1;x4<=x4h;++x4){
-	  p[x1l][x2][x3l][x4]=p[x1l][x2][x3l][x4-1]+nx5;    
-	  p[x1l][x2][x3l][x4][x5l]=p[x1l][x2][x3l][x4-1][x5l]+nx5*nx6;
-	  for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2][x3l][x4][x5]=p[x1l][x2][x3l][x4][x5-1]+nx6;
+      
+#ifdef _OPENMP
+      if(nb < 1) nb = omp_get_max_threads();
+#else
+      if(nb < 1) nb = 1;
+#endif
+      if(nb > cells) throw std::invalid_argument("rmem::domain: more blocks than cells");
+      grid();
+      
+      // --- the owned part of every block --- //
+      
+      bl.resize(nb*N), bh.resize(nb*N);
+      for(int t=0; t<nb; ++t){
+	int r = t;
+	for(int kk=N-1; kk>=0; --kk){
+	  const long c = r % g[kk];
+	  r /= g[kk];
+	  bl[t*N+kk] = lo[kk] + (c*n(kk)) / g[kk];
+	  bh[t*N+kk] = lo[kk] + ((c+1)*n(kk)) / g[kk] - 1;
 	}
-	for(long x3=x3l+1;x3<=x3h;++x3){
-	  p[x1l][x2][x3]=p[x1l][x2][x3-1]+nx4;
-	  p[x1l][x2][x3][x4l]=p[x1l][x2][x3-1][x4l]+nx4*nx5;
-	  p[x1l][x2][x3][x4l][x5l]=p[x1l][x2][x3-1][x4l][x5l]+nx4*nx5*nx6;
-	  for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2][x3][x4l][x5]=p[x1l][x2][x3][x4l][x5-1]+nx6;
-	  for(long x4=x4l+1;x4<=x4h;++x4){
-	    p[x1l][x2][x3][x4]=p[x1l][x2][x3][x4-1]+nx5;    
-	    p[x1l][x2][x3][x4][x5l]=p[x1l][x2][x3][x4-1][x5l]+nx5*nx6;
-	    for(long x5=x5l+1;x5<=x5h;++x5) p[x1l][x2][x3][x4][x5]=p[x1l][x2][x3][x4][x5-1]+nx6;
-	  }
+      }
+
+      // --- every thread allocates (and touches) its own block --- //
+      
+      p.assign(nb, ptr(NULL));
+      std::exception_ptr err;
+      std::mutex em;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static,1)
+#endif
+      for(int t=0; t<nb; ++t){
+	long bb[2*N];
+	for(int kk=0; kk<N; ++kk) bb[2*kk] = bl[t*N+kk] - h, bb[2*kk+1] = bh[t*N+kk] + h;
+	try{
+	  p[t] = detail::rarray<T,N>(o, rinit<T>(), bb);
+	}catch(...){
+	  std::lock_guard<std::mutex> lock(em);
+	  if(!err) err = std::current_exception();
 	}
       }
-      for(long x1=x1l+1;x1<=x1h;++x1){
-	p[x1]=p[x1-1]+nx2;
-	p[x1][x2l]=p[x1-1][x2l]+nx2*nx3;
-	p[x1][x2l][x3l]=p[x1-1][x2l][x3l]+nx2*nx3*nx4;
-	p[x1][x2l][x3l][x4l]=p[x1-1][x2l][x3l][x4l]+nx2*nx3*nx4*nx5;
-	p[x1][x2l][x3l][x4l][x5l]=p[x1-1][x2l][x3l][x4l][x5l]+nx2*nx3*nx4*nx5*nx6;
-	for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2l][x3l][x4l][x5]=p[x1][x2l][x3l][x4l][x5-1]+nx6;
-	for(long x4=x4l+1;x4<=x4h;++x4){
-	  p[x1][x2l][x3l][x4]=p[x1][x2l][x3l][x4-1]+nx5;    
-	  p[x1][x2l][x3l][x4][x5l]=p[x1][x2l][x3l][x4-1][x5l]+nx5*nx6;
-	  for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2l][x3l][x4][x5]=p[x1][x2l][x3l][x4][x5-1]+nx6;
+      if(err){
+	release();
+	std::rethrow_exception(err);
+      }
+    }
+
+    ~domain()
+    {
+      release();
+    }
+
+    domain(domain const&) = delete;
+    domain &operator=(domain const&) = delete;
+
+    long n(int const& d) const {return hi[d]-lo[d]+1;}
+    int blocks() const {return nb;}
+    int width() const {return h;}
+    int cuts(int const& d) const {return g[d];}
+
+    // --- block t, valid for blo(t,d)-width() <= x_d <= bhi(t,d)+width() --- //
+    
+    ptr block(int const& t) const {return p[t];}
+    long blo(int const& t, int const& d) const {return bl[t*N+d];}
+    long bhi(int const& t, int const& d) const {return bh[t*N+d];}
+
+    // --- block that owns a cell --- //
+    
+    template<typename... I> int owner(I const&... i) const
+    {
+      static_assert(sizeof...(I) == N, "rmem::domain: wrong number of indexes");
+      const long ii[] = {long(i)...};
+      long t = 0;
+      for(int kk=0; kk<N; ++kk) t = t*g[kk] + ((ii[kk] - lo[kk] + 1)*g[kk] + n(kk) - 1) / n(kk) - 1;
+      return int(t);
+    }
+
+    // --- a cell through its owner, for setup and output rather than sweeps --- //
+    
+    template<typename... I> T& operator()(I const&... i) const
+    {
+      const long ii[] = {long(i)...};
+      return *detail::rwalk<T,N>::at(p[owner(i...)], ii);
+    }
+
+    // --- fills the halo of block t from the blocks that own those cells --- //
+    
+    void exchange(int const& t)
+    {
+      if(!h) return;
+      
+      long a[N], e[N];
+      for(int kk=0; kk<N; ++kk){
+	a[kk] = bl[t*N+kk] - h, e[kk] = bh[t*N+kk] + h;
+	if(a[kk] < lo[kk]) a[kk] = lo[kk];
+	if(e[kk] > hi[kk]) e[kk] = hi[kk];
+      }
+
+      for(int s=0; s<nb; ++s){
+	if(s == t) continue;
+	
+	long c0[N], c1[N];
+	bool empty = false;
+	for(int kk=0; kk<N; ++kk){
+	  c0[kk] = (a[kk] > bl[s*N+kk]) ? a[kk] : bl[s*N+kk];
+	  c1[kk] = (e[kk] < bh[s*N+kk]) ? e[kk] : bh[s*N+kk];
+	  empty = empty || (c1[kk] < c0[kk]);
 	}
-	for(long x3=x3l+1;x3<=x3h;++x3){
-	  p[x1][x2l][x3]=p[x1][x2l][x3-1]+nx4;
-	  p[x1][x2l][x3][x4l]=p[x1][x2l][x3-1][x4l]+nx4*nx5;
-	  p[x1][x2l][x3][x4l][x5l]=p[x1][x2l][x3-1][x4l][x5l]+nx4*nx5*nx6;
-	  for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2l][x3][x4l][x5]=p[x1][x2l][x3][x4l][x5-1]+nx6;
-	  for(long x4=x4l+1;x4<=x4h;++x4){
-	    p[x1][x2l][x3][x4]=p[x1][x2l][x3][x4-1]+nx5;    
-	    p[x1][x2l][x3][x4][x5l]=p[x1][x2l][x3][x4-1][x5l]+nx5*nx6;
-	    for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2l][x3][x4][x5]=p[x1][x2l][x3][x4][x5-1]+nx6;
-	  }
+	if(empty) continue;
+
+	// --- row by row along the fastest dimension --- //
+	
+	long idx[N];
+	for(int kk=0; kk<N; ++kk) idx[kk] = c0[kk];
+	const long len = c1[N-1] - c0[N-1] + 1;
+	while(true){
+	  const T *src = detail::rwalk<T,N>::at(p[s], idx);
+	  std::copy(src, src + len, detail::rwalk<T,N>::at(p[t], idx));
+	  
+	  int kk = N-2;
+	  while(kk >= 0 && idx[kk] == c1[kk]) idx[kk] = c0[kk], --kk;
+	  if(kk < 0) break;
+	  ++idx[kk];
 	}
-	for(long x2=x2l+1;x2<=x2h;++x2){
-	  p[x1][x2]=p[x1][x2-1]+nx3;
-	  p[x1][x2][x3l]=p[x1][x2-1][x3l]+nx3*nx4;
-	  p[x1][x2][x3l][x4l]=p[x1][x2-1][x3l][x4l]+nx3*nx4*nx5;
-	  p[x1][x2][x3l][x4l][x5l]=p[x1][x2-1][x3l][x4l][x5l]+nx3*nx4*nx5*nx6;
-	  for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2][x3l][x4l][x5]=p[x1][x2][x3l][x4l][x5-1]+nx6;
-	  for(long x4=x4l+1;x4<=x4h;++x4){
-	    p[x1][x2][x3l][x4]=p[x1][x2][x3l][x4-1]+nx5;    
-	    p[x1][x2][x3l][x4][x5l]=p[x1][x2][x3l][x4-1][x5l]+nx5*nx6;
-	    for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2][x3l][x4][x5]=p[x1][x2][x3l][x4][x5-1]+nx6;
+      }
+    }
+
+    // --- all the halos at once, outside of a parallel region --- //
+    
+    void exchange()
+    {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static,1)
+#endif
+      for(int t=0; t<nb; ++t) exchange(t);
+    }
+    
+  private:
+    int h, nb, g[N];
+    std::vector<long> bl, bh;
+    std::vector<ptr> p;
+
+    // --- the g[0] x ... x g[N-1] = nb grid with the least cut area that
+    //     fits the domain, the slow dimensions are cut first on ties --- //
+    
+    void grid()
+    {
+      double best = -1;
+      int c[3] = {1, 1, 1};
+      for(c[0]=1; c[0]<=nb; ++c[0]){
+	if(nb % c[0]) continue;
+	for(c[1]=1; c[1]<=nb/c[0]; ++c[1]){
+	  if((nb/c[0]) % c[1]) continue;
+	  c[2] = nb/c[0]/c[1];
+	  if(N == 2 && c[2] != 1) continue;
+	  
+	  double area = 0;
+	  bool fits = true;
+	  for(int kk=0; kk<N; ++kk){
+	    double face = 1;
+	    for(int jj=0; jj<N; ++jj) if(jj != kk) face *= n(jj);
+	    area += (c[kk] - 1)*face;
+	    fits = fits && (c[kk] <= n(kk));
 	  }
-	  for(long x3=x3l+1;x3<=x3h;++x3){
-	    p[x1][x2][x3]=p[x1][x2][x3-1]+nx4;
-	    p[x1][x2][x3][x4l]=p[x1][x2][x3-1][x4l]+nx4*nx5;
-	    p[x1][x2][x3][x4l][x5l]=p[x1][x2][x3-1][x4l][x5l]+nx4*nx5*nx6;
-	    for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2][x3][x4l][x5]=p[x1][x2][x3][x4l][x5-1]+nx6;
-	    for(long x4=x4l+1;x4<=x4h;++x4){
-	      p[x1][x2][x3][x4]=p[x1][x2][x3][x4-1]+nx5;    
-	      p[x1][x2][x3][x4][x5l]=p[x1][x2][x3][x4-1][x5l]+nx5*nx6;
-	      for(long x5=x5l+1;x5<=x5h;++x5) p[x1][x2][x3][x4][x5]=p[x1][x2][x3][x4][x5-1]+nx6;
-	    }
+	  if(fits && (best < 0 || area < best)){
+	    best = area;
+	    for(int kk=0; kk<N; ++kk) g[kk] = c[kk];
 	  }
 	}
       }
-      return p;
+      if(best < 0) throw std::invalid_argument("rmem::domain: the blocks do not fit the domain");
     }
-  
-  template<typename T> void del_rmap(T ******&p,long const& x1l,long const& x2l,long const& x3l,long const& x4l,long const& x5l,long const& x6l)
-  {
-    //delete[] (p[x1l][x2l][x3l][x4l][x5l]+x6l);
-    delete[] (p[x1l][x2l][x3l][x4l]+x5l);
-    delete[] (p[x1l][x2l][x3l]+x4l);
-    delete[] (p[x1l][x2l]+x3l);
-    delete[] (p[x1l]+x2l);
-    delete[] (p+x1l);
-    p = NULL;
-  }
+
+    void release()
+    {
+      for(size_t t=0; t<p.size(); ++t){
+	if(!p[t]) continue;
+	char *t0 = (char*)(p[t] + bl[t*N] - h);
+#ifdef RMEM_STATS
+	detail::rstat_array(stats_free, N, t0, detail::rstat_clock::time_point());
+#endif
+	detail::rblock_free<T>(t0);
+	p[t] = NULL;
+      }
+    }
+  };
   
 }; 
 
@@ -0,0 +1,245 @@
+/* --------------------------------------------------------
+   Tests of the rawMem routines that depend on the operating system or
+   on threads: file and shared memory mappings and the block pools.
+
+   No dependencies, compile with e.g.:
+
+     g++ -O1 -g -std=c++11 -I.. rawMemTest.cpp -o rawMemTest -pthread
+     (add -lrt on glibc older than 2.34, -fsanitize=address,undefined
+      to also check the memory accesses)
+
+   Usage: ./rawMemTest [directory for the temporary files, default /tmp]
+
+   Prints one line per test and returns the number of failed checks.
+ */
+#include "rawMem.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace{
+
+  int nfail = 0;
+
+#define RCHECK(c) do{ if(!(c)){ fprintf(stderr, "  %s:%d: check failed: %s\n", __FILE__, __LINE__, #c); ++nfail; } }while(0)
+
+  std::string tmpdir = "/tmp";
+
+  std::string tmpname(const char *what)
+  {
+    return tmpdir + "/rawMemTest_" + what + "_" + std::to_string((long)getpid());
+  }
+
+  template<typename F> void run(const char *name, F f)
+  {
+    const int n0 = nfail;
+    try{
+      f();
+    }catch(std::exception const& e){
+      fprintf(stderr, "  exception: %s\n", e.what());
+      ++nfail;
+    }
+    printf("%-28s %s\n", name, (nfail == n0) ? "ok" : "FAILED");
+  }
+
+  // ****************************************************************** //
+
+  // --- written through map_shared, mapped again read-only, also from an
+  //     offset and as 1D arrays, which take the registry path in del_rarray --- //
+
+  void test_file_roundtrip()
+  {
+    const std::string f = tmpname("file");
+    const long nz = 3, ny = 4, nx = 5, off = 100;
+
+    float ***w = rmem::rarray<float>(rmem::mapped(f.c_str(), off, rmem::map_shared), 1, nz, 0, ny-1, -2, nx-3);
+    for(long z=1; z<=nz; ++z)
+      for(long y=0; y<ny; ++y)
+	for(long x=-2; x<=nx-3; ++x) w[z][y][x] = float(z*100 + y*10 + x);
+    rmem::del_rarray(w, 1, 0, -2);
+    RCHECK(w == NULL);
+
+    float ***r = rmem::rarray<float>(rmem::mapped(f.c_str(), off), 0, nz-1, 0, ny-1, 0, nx-1);
+    bool same = true;
+    for(long z=0; z<nz; ++z)
+      for(long y=0; y<ny; ++y)
+	for(long x=0; x<nx; ++x) same = same && (r[z][y][x] == float((z+1)*100 + y*10 + x-2));
+    RCHECK(same);
+
+    // --- the data of a mapped array, wrapped by rmap and detached --- //
+
+    float **m = rmem::rmap(&r[0][0][0], 0, nz*ny-1, 0, nx-1);
+    RCHECK(m[ny][0] == r[1][0][0]);
+    rmem::del_rmap(m, 0, 0);
+    RCHECK(m == NULL);
+    rmem::del_rarray(r, 0, 0, 0);
+
+    // --- 1D, from offsets that are not a multiple of 8 --- //
+
+    float *a = rmem::rarray<float>(rmem::mapped(f.c_str(), off), 0, nz*ny*nx-1);
+    RCHECK(a[0] == 98.f && a[nx] == 108.f);
+    float *b = rmem::rarray<float>(rmem::mapped(f.c_str(), off + 4*sizeof(float), rmem::map_private), 1, 3);
+    RCHECK(b[1] == 102.f && b[2] == 108.f);
+    b[1] = -1.f;
+    RCHECK(a[4] == 102.f);
+    rmem::del_rarray(b, 1);
+    rmem::del_rarray(a, 0);
+    RCHECK(a == NULL && b == NULL);
+
+    // --- a private mapping never writes to the file --- //
+
+    float *c = rmem::rarray<float>(rmem::mapped(f.c_str(), off), 0, 4);
+    RCHECK(c[4] == 102.f);
+    rmem::del_rarray(c, 0);
+
+    unlink(f.c_str());
+  }
+
+  // --- the same through a shared memory segment --- //
+
+  void test_shared_roundtrip()
+  {
+    const std::string s = "/rawMemTest_" + std::to_string((long)getpid());
+    const long ny = 6, nx = 7;
+
+    double **w = rmem::rarray<double>(rmem::shared(s.c_str(), 0, rmem::map_shared), 0, ny-1, 0, nx-1);
+    for(long y=0; y<ny; ++y)
+      for(long x=0; x<nx; ++x) w[y][x] = y + 0.5*x;
+
+    double **r = rmem::rarray<double>(rmem::shared(s.c_str()), 0, ny-1, 0, nx-1);
+    double *q = rmem::rarray<double>(rmem::shared(s.c_str(), nx*sizeof(double)), 0, nx-1);
+    w[1][2] = -3.;
+    RCHECK(r[ny-1][nx-1] == (ny-1) + 0.5*(nx-1));
+    RCHECK(r[1][2] == -3. && q[2] == -3.);
+
+    rmem::del_rarray(q, 0);
+    rmem::del_rarray(r, 0, 0);
+    rmem::del_rarray(w, 0, 0);
+    rmem::unlink_shared(s.c_str());
+  }
+
+  // --- a block freed by its own thread is taken back and re-initialized --- //
+
+  void test_pool_local()
+  {
+    rmem::ropt o;
+    o.pool = true;
+    
+    int **p = rmem::rarray<int>(o, rmem::filled(7), 0, 9, 1, 20);
+    int *d = &p[0][1];
+    p[3][4] = 0;
+    rmem::del_rarray(p, 0, 1);
+    
+    int **q = rmem::rarray<int>(o, rmem::filled(7), 0, 9, 1, 20);
+    RCHECK(&q[0][1] == d);
+    RCHECK(q[3][4] == 7 && q[9][20] == 7);
+    
+    // --- another shape gets another block --- //
+    
+    int **r = rmem::rarray<int>(o, 0, 9, 1, 21);
+    RCHECK(&r[0][1] != d && r[9][21] == 0);
+    rmem::del_rarray(r, 0, 1);
+    rmem::del_rarray(q, 0, 1);
+
+    // --- first-touch blocks are initialized again by slabs --- //
+
+    o.numa = rmem::numa_first_touch;
+    float ***f = rmem::rarray<float>(o, 0, 15, 0, 31, 0, 63);
+    float *fd = &f[0][0][0];
+    f[0][0][0] = f[15][31][63] = 1.f;
+    rmem::del_rarray(f, 0, 0, 0);
+    f = rmem::rarray<float>(o, rmem::filled(3.f), 0, 15, 0, 31, 0, 63);
+    RCHECK(&f[0][0][0] == fd);
+    bool same = true;
+    for(long z=0; z<16; ++z)
+      for(long y=0; y<32; ++y)
+	for(long x=0; x<64; ++x) same = same && (f[z][y][x] == 3.f);
+    RCHECK(same);
+    rmem::del_rarray(f, 0, 0, 0);
+    rmem::pool_trim();
+  }
+
+  // --- freed by another thread it goes on the remote stack, and the
+  //     owner takes it back when its bucket is empty --- //
+  
+  void test_pool_remote()
+  {
+    rmem::ropt o;
+    o.pool = true;
+    
+    double ***p = rmem::rarray<double>(o, 0, 3, 0, 4, 0, 5);
+    double *d = &p[0][0][0];
+    p[1][2][3] = 5.;
+    std::thread t([&p]{ rmem::del_rarray(p, 0, 0, 0); });
+    t.join();
+    RCHECK(p == NULL);
+    
+    double ***q = rmem::rarray<double>(o, 0, 3, 0, 4, 0, 5);
+    RCHECK(&q[0][0][0] == d && q[1][2][3] == 0.);
+    rmem::del_rarray(q, 0, 0, 0);
+
+    // --- many blocks freed by several threads at once --- //
+
+    const int nb = 32, nt = 4;
+    std::vector<float*> v(nb), old(nb);
+    for(int ii=0; ii<nb; ++ii) old[ii] = v[ii] = rmem::rarray<float>(o, 0, 99);
+    
+    std::vector<std::thread> th;
+    for(int tt=0; tt<nt; ++tt)
+      th.push_back(std::thread([&v, tt]{ for(int ii=tt; ii<nb; ii+=nt) rmem::del_rarray(v[ii], 0); }));
+    for(int tt=0; tt<nt; ++tt) th[tt].join();
+
+    int back = 0;
+    for(int ii=0; ii<nb; ++ii){
+      RCHECK(v[ii] == NULL);
+      v[ii] = rmem::rarray<float>(o, 0, 99);
+      for(int jj=0; jj<nb; ++jj) if(v[ii] == old[jj]) ++back;
+    }
+    RCHECK(back == nb);
+    for(int ii=0; ii<nb; ++ii) rmem::del_rarray(v[ii], 0);
+    rmem::pool_trim();
+  }
+
+  // --- the owner exits while its blocks are still in use: the pool stays
+  //     alive until the last one is freed, and that one releases it --- //
+  
+  void test_pool_exit()
+  {
+    rmem::ropt o;
+    o.pool = true;
+    
+    float **p = NULL, **q = NULL;
+    std::thread t([&]{
+	p = rmem::rarray<float>(o, rmem::filled(1.f), 0, 7, 0, 7);
+	q = rmem::rarray<float>(o, rmem::filled(2.f), 0, 7, 0, 7);
+	float **c = rmem::rarray<float>(o, 0, 7, 0, 7);
+	rmem::del_rarray(c, 0, 0);   // cached when the thread exits
+      });
+    t.join();
+    
+    RCHECK(p[7][7] == 1.f && q[0][0] == 2.f);
+    std::thread u([&p]{ rmem::del_rarray(p, 0, 0); });
+    u.join();
+    rmem::del_rarray(q, 0, 0);
+    RCHECK(p == NULL && q == NULL);
+  }
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  if(argc > 1) tmpdir = argv[1];
+
+  run("file map round trip", test_file_roundtrip);
+  run("shared memory round trip", test_shared_roundtrip);
+  run("pool, same thread", test_pool_local);
+  run("pool, remote frees", test_pool_remote);
+  run("pool, owner exits first", test_pool_exit);
+
+  if(nfail) printf("%d checks failed\n", nfail);
+  return nfail;
+}